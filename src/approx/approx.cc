@@ -1,87 +1,361 @@
 #include "approx.hh"
 
-#include <iostream>
 #include <algorithm>
 
 Approx::Approx(const s_trie* trie)
   : _trie(trie)
-  , _root(get_root(trie))
+  , _rows(1)
+  , _filtered(false)
+  , _candidate(0)
 {
+  set_limits({0, 0, 0}, std::chrono::steady_clock::time_point());
 }
 
-void Approx::handle_sequence(const DLRow* parent,
-                             const s_edge* child,
-                             const char* str,
-                             size_t offset)
+void Approx::set_trie(const s_trie* trie)
 {
-  // Build one row par chararacter in the sequence.
-  DLRow childmat(parent, _word, str[offset], _max_dist);
+  _trie = trie;
+}
 
-  if (childmat.is_final())
-    return;
+void Approx::set_limits(const s_limits& limits,
+                        std::chrono::steady_clock::time_point deadline,
+                        s_work* work)
+{
+  _limits = limits;
+  _limited = limits.edges != 0 || limits.rows != 0 || limits.deadline != 0;
+  _deadline = deadline;
+  _visited_edges = 0;
+  _computed_rows = 0;
+  _work = work;
+  _other_edges = 0;
+  _other_rows = 0;
+  _shared_edges = 0;
+  _shared_rows = 0;
+  _truncated = false;
+}
 
-  ++offset;
+bool Approx::is_truncated() const
+{
+  return _truncated;
+}
 
-  if (offset == child->length)
-  {
-    unsigned int d;
+bool Approx::over_limits()
+{
+  bool late = false;
 
-    // If this child is a word (frequency != 0), check the distance.
-    if (child->frequency != 0 && (d = childmat.get_dist()) <= _max_dist)
-      _results.emplace_back(childmat, child->frequency, d);
+  if ((_visited_edges & 63) == 0)
+  {
+    // Publish the work done since the last update and get the work of the others.
+    if (_work != nullptr)
+    {
+      _other_edges = (_work->edges += _visited_edges - _shared_edges) - _visited_edges;
+      _other_rows = (_work->rows += _computed_rows - _shared_rows) - _computed_rows;
+      _shared_edges = _visited_edges;
+      _shared_rows = _computed_rows;
+    }
 
-    // Recurse on the child.
-    if (child->children_count > 0)
-      search_rec(child, &childmat);
+    late = _limits.deadline != 0 && std::chrono::steady_clock::now() >= _deadline;
   }
-  else
-    handle_sequence(&childmat, child, str, offset);
+
+  return (_limits.edges != 0 && _other_edges + _visited_edges >= _limits.edges)
+    || (_limits.rows != 0 && _other_rows + _computed_rows >= _limits.rows)
+    || late;
 }
 
-void Approx::search_rec(const s_edge* edge,
-                        const DLRow* mat)
+Approx::Cursor::Cursor(Approx& approx)
+  : _approx(approx)
 {
-  const s_edge* child = get_child(edge);
+}
+
+Approx::Cursor Approx::open(const std::string& word,
+                            unsigned int min_dist,
+                            unsigned int max_dist)
+{
+  _word = word;
+  _min_dist = min_dist;
+  _max_dist = max_dist;
+
+  _query.set(word, max_dist);
+  _rows[0].init(_query);
+
+  _stack.clear();
+  _filtered = _trie->qgram != NULL && filter();
+
+  if (_filtered)
+    ;
+  else if (_trie->flags & TRIE_WIDE_OFFSETS)
+    push_root<s_wide_edge>();
+  else
+    push_root<s_edge>();
 
-  for (unsigned int i = 0; i < edge->children_count; ++i, ++child)
-    handle_sequence(mat, child, get_str(_trie, child->offset), 0);
+  return Cursor(*this);
 }
 
-void Approx::search(std::string& word, unsigned int max_dist)
+bool Approx::filter()
 {
-  DLRow mat(word.length() + 1, max_dist);
+  const s_qgram* index = _trie->qgram;
+  unsigned int q = index->header->q;
+  size_t n = _word.length();
 
-  _max_dist = max_dist;
-  _word = std::move(word);
+  if (_max_dist < 2 || n < q || n - q + 1 <= (size_t) _max_dist * (q + 1))
+    return false;
+
+  unsigned int threshold = n - q + 1 - _max_dist * (q + 1);
+
+  // The q-grams of the word, sorted to group the repeated ones.
+  _grams.clear();
+  for (size_t i = 0; i + q <= n; ++i)
+  {
+    unsigned long long gram = 0;
+
+    for (size_t j = 0; j < q; ++j)
+      gram = (gram << 8) | (unsigned char) _word[i + j];
+
+    _grams.push_back(gram);
+  }
+
+  std::sort(_grams.begin(), _grams.end());
+
+  // Estimate the cost of the filter.
+  unsigned long long cost = 0;
+  for (size_t i = 0; i < _grams.size(); ++i)
+  {
+    if (i > 0 && _grams[i] == _grams[i - 1])
+      continue;
 
-  search_rec(_root, &mat);
+    const s_qgram_entry* entry = find_gram(index, _grams[i]);
+    if (entry != NULL)
+      cost += entry->count;
+  }
 
-  std::sort(_results.begin(), _results.end());
+  if (cost > index->header->word_count)
+    return false;
 
-  printf("[");
+  if (_counts.size() < index->header->word_count)
+    _counts.resize(index->header->word_count);
 
-  if (_results.size() > 0)
+  // Count the shared q-grams, a repeated q-gram is counted at most as many times as in the word.
+  for (size_t i = 0; i < _grams.size(); )
   {
-    _results.front().dump();
+    size_t repeat = 1;
+    while (i + repeat < _grams.size() && _grams[i + repeat] == _grams[i])
+      ++repeat;
+
+    const s_qgram_entry* entry = find_gram(index, _grams[i]);
+    i += repeat;
+
+    if (entry == NULL)
+      continue;
+
+    const unsigned char* postings = index->postings + entry->offset;
+    const unsigned char* end = postings_end(index, entry);
+    unsigned long long id = 0;
+    unsigned long long previous = 0;
+    size_t occurrences = 0;
 
-    for (auto it = _results.cbegin() + 1; it != _results.cend(); ++it)
+    for (unsigned long long k = 0; k <= entry->count; ++k)
     {
-      printf(",");
-      it->dump();
+      if (k < entry->count)
+      {
+        unsigned long long delta = 0;
+        unsigned int shift = 0;
+        bool more = true;
+
+        while (more && postings != end && shift < 64)
+        {
+          delta |= (unsigned long long) (*postings & 0x7f) << shift;
+          shift += 7;
+          more = *postings++ & 0x80;
+        }
+
+        // A corrupted list: stop at the last valid id.
+        if (more || delta >= index->header->word_count - id)
+          k = entry->count;
+        else
+        {
+          id += delta;
+
+          if (occurrences > 0 && id == previous)
+          {
+            ++occurrences;
+            continue;
+          }
+        }
+      }
+
+      // A new word id, or the end of the list: count the previous one.
+      if (occurrences > 0)
+      {
+        if (_counts[previous] == 0)
+          _touched.push_back(previous);
+        _counts[previous] += std::min(occurrences, repeat);
+      }
+
+      previous = id;
+      occurrences = 1;
     }
   }
 
-  printf("]\n");
+  // Keep the words with enough shared q-grams and a compatible length.
+  _candidates.clear();
+  _candidate = 0;
+
+  for (unsigned long long id: _touched)
+  {
+    unsigned long long length = index->words[id].length;
 
-  _results.clear();
+    if (_counts[id] >= threshold && length + _max_dist >= n && length <= n + _max_dist)
+      _candidates.push_back(id);
+    _counts[id] = 0;
+  }
+
+  _touched.clear();
+  return true;
+}
+
+template <typename Edge>
+void Approx::push_root()
+{
+  const Edge* root = get_root<Edge>(_trie);
+
+  if (root->children_count > 0)
+    _stack.push_back({get_child(root), (unsigned int) root->children_count, 0});
+}
+
+bool Approx::Cursor::next(std::vector<Result>& results, size_t count)
+{
+  if (_approx._filtered)
+    return next_candidates(results, count);
+  else if (_approx._trie->flags & TRIE_WIDE_OFFSETS)
+    return next_edges<s_wide_edge>(results, count);
+  else
+    return next_edges<s_edge>(results, count);
 }
 
-Approx::Result::Result(const DLRow& mat, unsigned int frequency, unsigned int distance)
-  : _frequency(frequency)
+template <typename Edge>
+bool Approx::Cursor::next_edges(std::vector<Result>& results, size_t count)
+{
+  Approx& a = _approx;
+  size_t found = 0;
+
+  while (!a._stack.empty())
+  {
+    s_frame& frame = a._stack.back();
+
+    if (frame.remaining == 0)
+    {
+      a._stack.pop_back();
+      continue;
+    }
+
+    // Stop with the results found so far when a limit is exceeded.
+    if (a._limited && a.over_limits())
+    {
+      a._truncated = true;
+      a._stack.clear();
+      break;
+    }
+    ++a._visited_edges;
+
+    const Edge* child = (const Edge*) frame.child;
+    size_t depth = frame.depth;
+    frame.child = child + 1;
+    --frame.remaining;
+
+    const char* str = get_label(a._trie, child);
+    size_t end = depth + child->length;
+
+    if (a._rows.size() <= end)
+      a._rows.resize(end + 1);
+    if (a._path.size() < end)
+      a._path.resize(end);
+
+    // Build one row par chararacter in the sequence.
+    size_t n = a._query.compute(&a._rows[depth],
+                                depth > 0 ? &a._rows[depth - 1] : nullptr,
+                                str,
+                                child->length);
+    a._computed_rows += n;
+    std::copy(str, str + child->length, a._path.begin() + depth);
+
+    // Exact lookup: the siblings start with other characters, they cannot match.
+    if (a._max_dist == 0 && !a._rows[depth + 1].is_final())
+      a._stack.back().remaining = 0;
+
+    if (a._rows[depth + n].is_final())
+      continue;
+
+    unsigned int d;
+
+    // If this child is a word (frequency != 0), check the distance.
+    if (child->frequency != 0
+        && (d = a._rows[end].get_dist()) <= a._max_dist && d >= a._min_dist)
+    {
+      results.emplace_back(a._path.substr(0, end), child->frequency, d);
+      ++found;
+    }
+
+    // Visit the children of the child later.
+    if (child->children_count > 0)
+      a._stack.push_back({get_child(child), (unsigned int) child->children_count, end});
+
+    if (found == count)
+      return true;
+  }
+
+  return false;
+}
+
+bool Approx::Cursor::next_candidates(std::vector<Result>& results, size_t count)
+{
+  Approx& a = _approx;
+  const s_qgram* index = a._trie->qgram;
+  size_t found = 0;
+
+  while (a._candidate < a._candidates.size())
+  {
+    // Stop with the results found so far when a limit is exceeded.
+    if (a._limited && a.over_limits())
+    {
+      a._truncated = true;
+      a._candidates.clear();
+      break;
+    }
+    ++a._visited_edges;
+
+    const s_qgram_word& word = index->words[a._candidates[a._candidate++]];
+    const char* str = index->chars + word.offset;
+
+    if (a._rows.size() <= word.length)
+      a._rows.resize(word.length + 1);
+
+    // Verify the candidate with the same rows as the trie walk.
+    size_t n = a._query.compute(&a._rows[0], nullptr, str, word.length);
+    a._computed_rows += n;
+
+    if (a._rows[n].is_final())
+      continue;
+
+    unsigned int d = a._rows[word.length].get_dist();
+
+    if (d <= a._max_dist && d >= a._min_dist)
+    {
+      results.emplace_back(std::string(str, word.length), word.frequency, d);
+      ++found;
+    }
+
+    if (found == count)
+      return true;
+  }
+
+  return false;
+}
+
+Approx::Result::Result(std::string word, unsigned long frequency, unsigned int distance)
+  : _word(std::move(word))
+  , _frequency(frequency)
   , _distance(distance)
+  , _tag(nullptr)
 {
-  _word.reserve(mat.get_offset());
-  mat.get_word(_word);
 }
 
 bool Approx::Result::operator<(const Result& res) const
@@ -91,7 +365,32 @@ bool Approx::Result::operator<(const Result& res) const
                                              (_frequency == res._frequency && _word < res._word))));
 }
 
-void Approx::Result::dump() const
+const std::string& Approx::Result::get_word() const
+{
+  return _word;
+}
+
+unsigned long Approx::Result::get_frequency() const
+{
+  return _frequency;
+}
+
+unsigned int Approx::Result::get_distance() const
+{
+  return _distance;
+}
+
+const std::string* Approx::Result::get_tag() const
+{
+  return _tag;
+}
+
+void Approx::Result::set_frequency(unsigned long frequency)
+{
+  _frequency = frequency;
+}
+
+void Approx::Result::set_tag(const std::string* tag)
 {
-  printf("{\"word\":\"%s\",\"freq\":%u,\"distance\":%u}", _word.c_str(), _frequency, _distance);
+  _tag = tag;
 }
@@ -1,12 +1,38 @@
 #ifndef APPROX_HH
 # define APPROX_HH
 
+# include <atomic>
+# include <chrono>
 # include <string>
 # include <vector>
 
 # include "ptrie.hh"
 # include "dl-row.hh"
 
+/**
+ * \brief The limits of the work of a query, 0 means no limit.
+ */
+typedef struct
+{
+  // Maximal number of edges visited.
+  unsigned long edges;
+
+  // Maximal number of matrix rows computed.
+  unsigned long rows;
+
+  // Maximal duration, in milliseconds.
+  unsigned long deadline;
+} s_limits;
+
+/**
+ * \brief The work done by several Approx objects sharing the same limits.
+ */
+typedef struct
+{
+  std::atomic<unsigned long> edges;
+  std::atomic<unsigned long> rows;
+} s_work;
+
 class Approx
 {
 public:
@@ -19,11 +45,11 @@ public:
     /**
      * \brief Construct a result.
      *
-     * \param mat The matrix row that holds the word.
+     * \param word The word.
      * \param frequency The frequency of the word.
      * \param distance The distance between this word and the word to approximate.
      */
-    Result(const DLRow& mat, unsigned int frequency, unsigned int distance);
+    Result(std::string word, unsigned long frequency, unsigned int distance);
 
     /**
      * \brief Order the result.
@@ -36,16 +62,83 @@ public:
     bool operator<(const Result& res) const;
 
     /**
-     * \brief Output the result in the JSON format.
+     * \brief Get the word.
+     */
+    const std::string& get_word() const;
+
+    /**
+     * \brief Get the frequency of the word.
+     */
+    unsigned long get_frequency() const;
+
+    /**
+     * \brief Get the distance between the word and the word to approximate.
+     */
+    unsigned int get_distance() const;
+
+    /**
+     * \brief Get the tag of the dictionary the word comes from.
+     *
+     * \return The tag, or nullptr if the dictionary is not tagged.
+     */
+    const std::string* get_tag() const;
+
+    /**
+     * \brief Set the frequency of the word.
+     */
+    void set_frequency(unsigned long frequency);
+
+    /**
+     * \brief Set the tag of the dictionary the word comes from.
      *
-     * Example: {"word":"test","freq":49216987,"distance":0}
+     * \param tag The tag, it must outlive the result.
      */
-    void dump() const;
+    void set_tag(const std::string* tag);
 
   private:
     std::string _word;
-    unsigned int _frequency;
+    unsigned long _frequency;
     unsigned int _distance;
+    const std::string* _tag;
+  };
+
+  /**
+   * \brief Cursor class.
+   *
+   * A cursor walks the trie iteratively and yields the results in batches,
+   * in the traversal order (they are not sorted). The traversal state and the
+   * matrix rows live in the Approx object, so only the last opened cursor of
+   * an Approx object can be used.
+   */
+  class Cursor
+  {
+  public:
+    /**
+     * \brief Get the next results.
+     *
+     * \param results The vector to append the results to.
+     * \param count The maximal number of results to append.
+     * \return true if the traversal is not over, false otherwise.
+     */
+    bool next(std::vector<Result>& results, size_t count);
+
+  private:
+    friend class Approx;
+
+    Cursor(Approx& approx);
+
+    /**
+     * \brief Get the next results, for a given edge format.
+     */
+    template <typename Edge>
+    bool next_edges(std::vector<Result>& results, size_t count);
+
+    /**
+     * \brief Get the next results among the q-gram filter candidates.
+     */
+    bool next_candidates(std::vector<Result>& results, size_t count);
+
+    Approx& _approx;
   };
 
   /**
@@ -56,60 +149,152 @@ public:
   Approx(const s_trie* trie);
 
   /**
-   * \brief Approximative search.
+   * \brief Change the trie to work with.
    *
-   * This function outputs on std::cout all words in the trie with a distance to
-   * the word argument lower or equal to the max_dist argument.
+   * It must not be called while a cursor is in use.
    *
-   * The output is a JSON array, for example:
-   * [{"word":"test","freq":49216987,"distance":0},{"word":"est","freq":1991137112,"distance":1}]
-   * followed by a newline.
+   * \param trie The new trie.
+   */
+  void set_trie(const s_trie* trie);
+
+  /**
+   * \brief Limit the work of the next cursors.
+   *
+   * The limits apply to all the cursors opened until the next call. When a limit
+   * is exceeded, the cursor stops and the search is marked as truncated.
+   *
+   * When the work is shared, the limits apply to the work of all the Approx
+   * objects sharing it. Each one adds its work to the shared one every 64 edges,
+   * so the limits can be exceeded by up to 64 edges per object.
+   *
+   * \param limits The limits.
+   * \param deadline The time point after which the cursors stop, if limits.deadline is not 0.
+   * \param work The work shared with other Approx objects, reset by the caller, or nullptr.
+   */
+  void set_limits(const s_limits& limits,
+                  std::chrono::steady_clock::time_point deadline,
+                  s_work* work = nullptr);
+
+  /**
+   * \brief Determine whether a limit stopped a cursor since the last call to set_limits().
+   */
+  bool is_truncated() const;
+
+  /**
+   * \brief Open a cursor on the words lying between min_dist and max_dist.
+   *
+   * If the trie has a q-gram index and the filter is expected to be cheaper
+   * than the trie walk, the cursor only verifies the filter candidates.
    *
    * \param word The word to approximate.
+   * \param min_dist The minimal distance.
    * \param max_dist The maximal distance.
+   * \return The cursor.
    */
-  void search(std::string& word, unsigned int max_dist);
+  Cursor open(const std::string& word,
+              unsigned int min_dist,
+              unsigned int max_dist);
 
 private:
+  /**
+   * \brief A node of the trie whose children remain to be visited.
+   */
+  typedef struct
+  {
+    // The next child to visit, either a s_edge or a s_wide_edge.
+    const void* child;
+    unsigned int remaining;
+
+    // The depth of the node, i.e. the index of its row.
+    size_t depth;
+  } s_frame;
+
   const s_trie* _trie;
 
+  unsigned int _max_dist;
+
   /*
-   * Root edge: offset = 0, length = 0, frequency = 0
-   * get_child(_root) = the leftmost edge of the root node
+   * Words closer than this distance were collected by a previous pass
+   * and are not added again.
    */
-  const s_edge* _root;
-
-  unsigned int _max_dist;
+  unsigned int _min_dist;
   std::string _word;
 
-  std::vector<Result> _results;
+  /*
+   * The word columns and the row kernel of the query.
+   */
+  DLQuery _query;
+
+  /*
+   * Traversal state, kept across queries to reuse the memory:
+   * - the explicit stack of nodes;
+   * - the rows of the matrix along the current path, row i matches _path[i-1].
+   */
+  std::vector<s_frame> _stack;
+  std::vector<DLRow> _rows;
+  std::string _path;
+
+  /*
+   * q-gram filter state, also kept across queries:
+   * - the candidate word ids and the next one to verify;
+   * - the number of q-grams shared with the word, per word id;
+   * - the word ids with a non null count;
+   * - the q-grams of the word.
+   */
+  bool _filtered;
+  std::vector<unsigned long long> _candidates;
+  size_t _candidate;
+  std::vector<unsigned int> _counts;
+  std::vector<unsigned long long> _touched;
+  std::vector<unsigned long long> _grams;
+
+  /*
+   * The work limits and the work done since they were set:
+   * - by this object;
+   * - by the other objects sharing the work, as of the last update of the shared work;
+   * - by this object as of the last update of the shared work.
+   */
+  s_limits _limits;
+  bool _limited;
+  std::chrono::steady_clock::time_point _deadline;
+  unsigned long _visited_edges;
+  unsigned long _computed_rows;
+  s_work* _work;
+  unsigned long _other_edges;
+  unsigned long _other_rows;
+  unsigned long _shared_edges;
+  unsigned long _shared_rows;
+  bool _truncated;
 
   /**
-   * \brief Handle a string sequence from the trie.
-   *
-   * It will recursively create a new row for each character to compute the distance.
+   * \brief Determine whether the work limits are exceeded.
    *
-   * \param parent The previous row.
-   * \param child The current child in the trie.
-   * \param str The current sequence.
-   * \param offset The current offset in the sequence.
+   * The clock is only read, and the shared work updated, every 64 edges.
    */
-  void handle_sequence(const DLRow* parent,
-                       const s_edge* child,
-                       const char* str,
-                       size_t offset);
-
+  bool over_limits();
 
   /**
-   * \brief Recursive approximative search.
+   * \brief Select the candidates with the q-gram count filter.
+   *
+   * A word within the distance d of the word to approximate, of length n, shares
+   * at least n - q + 1 - d * (q + 1) of its q-grams: an edit operation destroys
+   * at most q q-grams and a transposition at most q + 1.
    *
-   * This function recursively find all the words that match the condition.
+   * The filter is used when d >= 2, when this bound is positive and when
+   * the posting lists to read are shorter than the number of words.
    *
-   * \param edge The edge to recurse on.
-   * \param mat The last row of the distance matrix (it will be shared by all children).
+   * \return true if the filter is used, false if the trie must be walked.
+   */
+  bool filter();
+
+  /**
+   * \brief Push the root node on the stack, for a given edge format.
+   *
+   * Root edge: offset = 0, length = 0, frequency = 0
+   * get_child(root) = the leftmost edge of the root node
    */
-  void search_rec(const s_edge* edge,
-                  const DLRow* mat);
+  template <typename Edge>
+  void push_root();
 };
 
 # endif /* !APPROX_HH */
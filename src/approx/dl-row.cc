@@ -1,60 +1,312 @@
 #include "dl-row.hh"
 
-DLRow::DLRow(size_t width, unsigned int max_dist)
-  : _parent(nullptr)
-  , _width(width)
-  , _offset(0)
-  , _maxcol(max_dist)
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+DLRow::DLRow()
+  : _offset(0)
+  , _band(0)
+  , _last(0)
+  , _maxcol(-1)
+  , _c(0)
+{
+}
+
+void DLRow::init(size_t width, unsigned int max_dist)
 {
+  _dist.resize(width);
+  _offset = 0;
+  _maxcol = max_dist;
+  _c = 0;
+
   for (size_t i = 0; i < width; ++i)
     _dist[i] = i;
+
+  _last = width - 1;
+}
+
+void DLRow::init(const DLQuery& query)
+{
+  unsigned int max_dist = query._max_dist;
+
+  if (max_dist > DL_BAND_MAX_DIST)
+  {
+    init(query._word.length() + 1, max_dist);
+    return;
+  }
+
+  _offset = 0;
+  _maxcol = max_dist;
+  _c = 0;
+
+  // The columns -max_dist to max_dist + 1, the ones before the first column are out of the matrix.
+  _band = 0;
+  for (unsigned int t = 0; t < DL_BAND_WIDTH; ++t)
+  {
+    unsigned long long cell = t < max_dist ? max_dist + 1 : std::min(t - max_dist, max_dist + 1);
+    _band |= cell << (8 * t);
+  }
+
+  _last = std::min(query._word.length(), (size_t) max_dist + 1);
 }
 
-DLRow::DLRow(const DLRow* parent,
-             const std::string& word,
-             char c,
-             unsigned int max_dist)
-  : _parent(parent)
-  , _width(parent->_width)
-  , _offset(parent->_offset + 1)
-  , _maxcol(_offset <= max_dist ? 0 : -1)
-  , _c(c)
+void DLRow::compute(const DLRow& parent,
+                    const DLRow* grandparent,
+                    const std::string& word,
+                    char c,
+                    unsigned int max_dist)
 {
+  size_t width = parent._dist.size();
+
+  _dist.resize(width);
+  _offset = parent._offset + 1;
+  _maxcol = _offset <= max_dist ? 0 : -1;
+  _c = c;
+
   _dist[0] = _offset;
 
   size_t j;
-  size_t upper_bound = std::min(_width, (size_t) _parent->_maxcol + 2);
+  size_t upper_bound = std::min(width, (size_t) parent._maxcol + 2);
 
   for (j = 1; j < upper_bound; ++j)
   {
-    _dist[j] = std::min(std::min(parent->_dist[j] + 1, // delete
+    _dist[j] = std::min(std::min(parent._dist[j] + 1, // delete
                                  _dist[j-1] + 1), // insert
-                        parent->_dist[j-1] + (c != word[j-1])); // equal or substitution
+                        parent._dist[j-1] + (c != word[j-1])); // equal or substitution
 
-    if (_offset > 1 && j > 1 && c == word[j-2] && parent->_c == word[j-1])
-      _dist[j] = std::min(_dist[j], parent->_parent->_dist[j-2] + (c != word[j-1])); // transposition
+    if (grandparent != nullptr && j > 1 && c == word[j-2] && parent._c == word[j-1])
+      _dist[j] = std::min(_dist[j], grandparent->_dist[j-2] + (c != word[j-1])); // transposition
 
     if (_dist[j] <= max_dist)
       _maxcol = j;
   }
 
-  for (; j < _width; ++j)
+  for (; j < width; ++j)
     _dist[j] = max_dist + 1;
+
+  _last = _dist[width - 1];
 }
 
-unsigned int DLRow::get_dist() const
+namespace
+{
+  /*
+   * The bands are vectors of 8 cells of one byte each, the cell t in the byte t.
+   * The cells never exceed 127, so the operations do not carry to the next cell.
+   */
+#ifdef __SSE2__
+  typedef __m128i band;
+
+  band load_band(const unsigned char* cells)
+  {
+    return _mm_loadl_epi64((const __m128i*) cells);
+  }
+
+  band load_band(const unsigned long long& cells)
+  {
+    return load_band((const unsigned char*) &cells);
+  }
+
+  band splat_band(char c) { return _mm_set1_epi8(c); }
+
+  unsigned long long store_band(band b)
+  {
+    unsigned long long cells;
+
+    _mm_storel_epi64((__m128i*) &cells, b);
+    return cells;
+  }
+
+  band add_band(band a, band b) { return _mm_add_epi8(a, b); }
+  band and_band(band a, band b) { return _mm_and_si128(a, b); }
+  band or_band(band a, band b) { return _mm_or_si128(a, b); }
+  band andnot_band(band a, band b) { return _mm_andnot_si128(a, b); }
+  band min_band(band a, band b) { return _mm_min_epu8(a, b); }
+  band eq_band(band a, band b) { return _mm_cmpeq_epi8(a, b); }
+
+  template <int n>
+  band shift_up(band b) { return _mm_slli_si128(b, n); }
+
+  template <int n>
+  band shift_down(band b) { return _mm_srli_si128(b, n); }
+
+  /*
+   * The index of the last of the first width cells of a that are lower
+   * or equal to the ones of b, -1 if none.
+   */
+  int last_le(band a, band b, int width)
+  {
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(a, b), a)) & ((1u << width) - 1);
+
+    return mask != 0 ? 31 - __builtin_clz(mask) : -1;
+  }
+#else
+  typedef unsigned long long band;
+
+  const band high = 0x8080808080808080ULL;
+
+  band load_band(const unsigned char* cells)
+  {
+    band b;
+
+    std::memcpy(&b, cells, sizeof (b));
+# if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    b = __builtin_bswap64(b);
+# endif
+    return b;
+  }
+
+  band load_band(const unsigned long long& cells) { return cells; }
+  band splat_band(char c) { return (unsigned char) c * 0x0101010101010101ULL; }
+  unsigned long long store_band(band b) { return b; }
+  band add_band(band a, band b) { return a + b; }
+  band and_band(band a, band b) { return a & b; }
+  band or_band(band a, band b) { return a | b; }
+  band andnot_band(band a, band b) { return ~a & b; }
+
+  band min_band(band a, band b)
+  {
+    // 0xff in the cells where a >= b.
+    band ge = (((a | high) - b) & high) >> 7;
+
+    return a ^ ((a ^ b) & ((ge << 8) - ge));
+  }
+
+  band eq_band(band a, band b)
+  {
+    // 0x80 in the cells where a == b, then 0xff.
+    band x = a ^ b;
+    band zero = ~(((x & ~high) + ~high) | x | ~high);
+
+    return zero | (zero - (zero >> 7));
+  }
+
+  template <int n>
+  band shift_up(band b) { return b << (8 * n); }
+
+  template <int n>
+  band shift_down(band b) { return b >> (8 * n); }
+
+  int last_le(band a, band b, int width)
+  {
+    // 0x80 in the cells where a <= b.
+    band le = ((b | high) - a) & high & (~0ULL >> (64 - 8 * width));
+
+    return le != 0 ? (63 - __builtin_clzll(le)) / 8 : -1;
+  }
+#endif
+}
+
+template <unsigned int max_dist>
+size_t DLRow::compute_band(const DLQuery& query,
+                           DLRow* rows,
+                           const DLRow* grandparent,
+                           const char* str,
+                           size_t length)
 {
-  return _dist[_width - 1];
+  const int width = 2 * max_dist + 1;
+  const unsigned long long cap = max_dist + 1;
+  const unsigned long long ones = 0x0101010101010101ULL;
+  const unsigned long long in_band = ~0ULL >> (64 - 8 * width);
+
+  const band one = load_band(ones);
+  const band caps = load_band(cap * ones);
+  const band maxs = load_band(max_dist * ones);
+  const band mask = load_band(in_band);
+  const band tail = load_band(cap * ones & ~in_band);
+
+  // Cells shifted in from before the band when looking s columns back, plus s.
+  const band fill1 = load_band(ones + cap);
+  const band fill2 = load_band(2 * ones + cap * 0x0101);
+  const band fill4 = load_band(4 * ones + cap * 0x01010101);
+
+  // The last two rows stay in registers along the sequence.
+  band p = load_band(rows[0]._band);
+  band g = load_band(grandparent != nullptr ? grandparent->_band : 0ULL);
+  band transposable = load_band(grandparent != nullptr ? ~0ULL : 0ULL);
+  band parent_c = splat_band(rows[0]._c);
+  size_t offset = rows[0]._offset;
+  size_t word_length = query._word.length();
+  const unsigned char* chars = query.get_chars();
+  const unsigned char* valid = query.get_valid();
+
+  for (size_t i = 0; i < length; ++i)
+  {
+    DLRow& row = rows[i + 1];
+    band c = splat_band(str[i]);
+    ptrdiff_t first = (ptrdiff_t) ++offset - max_dist;
+    band word = load_band(chars + first);
+    band columns = load_band(valid + first);
+    band match = and_band(eq_band(word, c), columns);
+    band prev_match = and_band(eq_band(load_band(chars + first - 1), c), load_band(valid + first - 1));
+    band parent_match = and_band(eq_band(word, parent_c), columns);
+
+    // Out of reach (i.e. at least cap) if the characters do not transpose.
+    band transposes = and_band(and_band(prev_match, parent_match), transposable);
+    band cost = andnot_band(match, one);
+    band d = min_band(min_band(add_band(shift_down<1>(p), one), // delete
+                               add_band(p, cost)), // equal or substitution
+                      add_band(add_band(g, cost), andnot_band(transposes, caps))); // transposition
+
+    // Insert: the cell t is also the cell t - s plus s, in log2(width) steps.
+    if (width > 1)
+      d = min_band(d, add_band(shift_up<1>(d), fill1));
+    if (width > 2)
+      d = min_band(d, add_band(shift_up<2>(d), fill2));
+    if (width > 4)
+      d = min_band(d, add_band(shift_up<4>(d), fill4));
+
+    // The cells past the band are read by the next row, as cap.
+    d = or_band(and_band(min_band(d, caps), mask), tail);
+
+    unsigned long long cells = store_band(d);
+    int last_live = last_le(d, maxs, width);
+
+    row._band = cells;
+    row._offset = offset;
+    row._c = str[i];
+    row._maxcol = last_live >= 0 ? first + last_live : -1;
+
+    // The last column, cap if it is out of the band.
+    size_t last = word_length - first;
+    row._last = last < (size_t) width ? (cells >> (8 * last)) & 0xff : cap;
+
+    if (last_live < 0)
+      return i + 1;
+
+    g = p;
+    p = d;
+    parent_c = c;
+    transposable = load_band(~0ULL);
+  }
+
+  return length;
 }
 
-void DLRow::get_word(std::string& w) const
+size_t DLRow::compute_generic(const DLQuery& query,
+                              DLRow* rows,
+                              const DLRow* grandparent,
+                              const char* str,
+                              size_t length)
 {
-  // Recursively retrieving the word we computed the distance with.
-  if (_parent != nullptr)
+  for (size_t i = 0; i < length; ++i)
   {
-    _parent->get_word(w);
-    w.push_back(_c);
+    rows[i + 1].compute(rows[i], i > 0 ? &rows[i - 1] : grandparent, query._word, str[i], query._max_dist);
+
+    if (rows[i + 1].is_final())
+      return i + 1;
   }
+
+  return length;
+}
+
+unsigned int DLRow::get_dist() const
+{
+  return _last;
 }
 
 bool DLRow::is_final() const
@@ -62,7 +314,42 @@ bool DLRow::is_final() const
   return _maxcol < 0;
 }
 
-size_t DLRow::get_offset() const
+DLQuery::DLQuery()
+  : _max_dist(0)
+  , _kernel(&DLRow::compute_generic)
 {
-  return _offset;
+}
+
+void DLQuery::set(const std::string& word, unsigned int max_dist)
+{
+  static const kernel kernels[DL_BAND_MAX_DIST + 1] =
+  {
+    &DLRow::compute_band<0>,
+    &DLRow::compute_band<1>,
+    &DLRow::compute_band<2>,
+    &DLRow::compute_band<3>
+  };
+
+  _word = word;
+  _max_dist = max_dist;
+  _kernel = max_dist <= DL_BAND_MAX_DIST ? kernels[max_dist] : &DLRow::compute_generic;
+
+  if (max_dist > DL_BAND_MAX_DIST)
+    return;
+
+  // The bands read up to DL_BAND_WIDTH columns before and after the word.
+  size_t size = DL_BAND_WIDTH + word.length() + 1 + DL_BAND_WIDTH;
+
+  _chars.assign(size, 0);
+  _valid.assign(size, 0);
+
+  // Do not keep the memory of a much longer word.
+  if (_chars.capacity() > 2 * size && _chars.capacity() > 4096)
+  {
+    _chars.shrink_to_fit();
+    _valid.shrink_to_fit();
+  }
+
+  std::memcpy(_chars.data() + DL_BAND_WIDTH + 1, word.data(), word.length());
+  std::memset(_valid.data() + DL_BAND_WIDTH + 1, 0xff, word.length());
 }
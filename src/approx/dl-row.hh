@@ -2,41 +2,73 @@
 # define DL_ROW_HH
 
 # include <string>
+# include <vector>
+
+/*
+ * The largest distance with a band kernel, and the number of cells of a band:
+ * the 2 * max_dist + 1 columns plus the one read past the band.
+ */
+# define DL_BAND_MAX_DIST 3
+# define DL_BAND_WIDTH (2 * DL_BAND_MAX_DIST + 2)
+
+class DLQuery;
 
 /**
  * \brief DLRow class.
  *
  * This class represents a row of the matrix to compute the Damareau-Lenvenstein distance.
- * Like the trie itself, the matrix is implemented hierarchically. As we recurse
- * in the trie, for each character we add a row (1 row = 1 instance of DLRow)
- * that is connected to the parent row to avoid data duplication across all the children.
+ * Like the trie itself, the matrix is implemented hierarchically. As we walk down
+ * the trie, for each character we compute a row (1 row = 1 instance of DLRow)
+ * from the previous ones, which are shared by all the children.
+ *
+ * The rows are meant to be stored in an arena and reused across queries:
+ * computing a row does not allocate memory once the row is as wide as the matrix.
+ *
+ * The rows computed for a DLQuery with a maximal distance k <= DL_BAND_MAX_DIST
+ * only hold the band of the matrix where the distance can be lower or equal to
+ * k, i.e. the columns offset - k to offset + k, capped at k + 1. The cells
+ * outside of the matrix are read as k + 1 too, so the band is never clipped.
  */
 class DLRow
 {
 public:
   /**
-   * \brief Construct the first line of the matrix.
+   * \brief Construct an empty row.
+   */
+  DLRow();
+
+  /**
+   * \brief Make this row the first line of the matrix.
    *
    * \param width The width of the matrix (i.e. the length of the word to approximate + 1).
    * \param max_dist The maximal distance.
    */
-  DLRow(size_t width, unsigned int max_dist);
+  void init(size_t width, unsigned int max_dist);
+
+  /**
+   * \brief Make this row the first line of the matrix of a query.
+   *
+   * \param query The query.
+   */
+  void init(const DLQuery& query);
 
   /**
-   * \brief Construct a new row.
+   * \brief Compute a new row.
    *
    * It computes the distance between the word to approximate and the char
    * sequence that is build during the trie traversal.
    *
    * \param parent The parent, i.e. the previous row in the matrix.
+   * \param grandparent The row before the parent, or nullptr if the parent is the first line.
    * \param word The word to approximate.
    * \param c The character associated to the row.
    * \param max_dist The maximal distance.
    */
-  DLRow(const DLRow* parent,
-        const std::string& word,
-        char c,
-        unsigned int max_dist);
+  void compute(const DLRow& parent,
+               const DLRow* grandparent,
+               const std::string& word,
+               char c,
+               unsigned int max_dist);
 
   /**
    * \brief Get the distance computed so far.
@@ -45,15 +77,6 @@ public:
    */
   unsigned int get_dist() const;
 
-  /**
-   * \brief Get the complete word.
-   *
-   * It is the word in the trie that was compared to the word to approximate.
-   *
-   * \param word A reference to a string that will hold the result.
-   */
-  void get_word(std::string& word) const;
-
   /**
    * \brief Determine whether it useless to continue in this branch.
    *
@@ -64,18 +87,22 @@ public:
    */
   bool is_final() const;
 
+private:
+  friend class DLQuery;
+
+  std::vector<unsigned int> _dist;
+  size_t _offset;
+
   /**
-   * \brief Get the offset of the current row in the total matrix.
-   *
-   * \return The offfset of the row.
+   * The band of a row computed for a DLQuery with a small distance,
+   * one byte per cell: the byte t is the column offset - max_dist + t.
    */
-  size_t get_offset() const;
+  unsigned long long _band;
 
-private:
-  const DLRow* _parent;
-  size_t _width;
-  size_t _offset;
-  unsigned int _dist[256];
+  /**
+   * Holds the distance to the whole word (i.e. the last column).
+   */
+  unsigned int _last;
 
   /**
    * Holds the index of the last column with a distance
@@ -83,6 +110,112 @@ private:
    */
   int _maxcol;
   char _c;
+
+  /**
+   * \brief Compute the rows of a char sequence in the band of width 2 * max_dist + 1.
+   *
+   * The band has a fixed width and fits in a vector of 8 bytes, so a row is
+   * computed with a few branch-free vector operations (SSE2 when available).
+   * The last two rows are kept in registers along the sequence.
+   */
+  template <unsigned int max_dist>
+  static size_t compute_band(const DLQuery& query,
+                             DLRow* rows,
+                             const DLRow* grandparent,
+                             const char* str,
+                             size_t length);
+
+  /**
+   * \brief Compute the rows of a char sequence on the whole width, for the larger distances.
+   */
+  static size_t compute_generic(const DLQuery& query,
+                                DLRow* rows,
+                                const DLRow* grandparent,
+                                const char* str,
+                                size_t length);
 };
 
+/**
+ * \brief DLQuery class.
+ *
+ * The word to approximate and its maximal distance, prepared once per query:
+ * - for the band kernels, the columns of the word: chars[j] == word[j - 1] and
+ *   valid[j] == 0xff for the columns 1 to n, 0 for the columns before and after
+ *   the word read by the bands. A band of matches with a character c is then
+ *   (chars == c) & valid;
+ * - the kernel computing the rows for this distance.
+ */
+class DLQuery
+{
+public:
+  DLQuery();
+
+  /**
+   * \brief Prepare a new query.
+   *
+   * \param word The word to approximate.
+   * \param max_dist The maximal distance.
+   */
+  void set(const std::string& word, unsigned int max_dist);
+
+  /**
+   * \brief Compute the rows of a char sequence.
+   *
+   * It stops at the first row where it is useless to continue (see DLRow::is_final()).
+   *
+   * \param rows The rows, rows[0] is the row before the sequence and rows[i] will
+   * hold the row of str[i - 1]. rows[0] must have been initialized or computed
+   * for this query.
+   * \param grandparent The row before rows[0], or nullptr if rows[0] is the first line.
+   * \param str The char sequence.
+   * \param length The length of the sequence.
+   * \return The number of rows computed.
+   */
+  size_t compute(DLRow* rows, const DLRow* grandparent, const char* str, size_t length) const;
+
+private:
+  friend class DLRow;
+
+  typedef size_t (*kernel)(const DLQuery&, DLRow*, const DLRow*, const char*, size_t);
+
+  std::string _word;
+  unsigned int _max_dist;
+  kernel _kernel;
+
+  /*
+   * The chars and the valid columns of the word, starting DL_BAND_WIDTH
+   * columns before the first one.
+   */
+  std::vector<unsigned char> _chars;
+  std::vector<unsigned char> _valid;
+
+  /**
+   * \brief Get the chars of the word, from column 0.
+   */
+  const unsigned char* get_chars() const;
+
+  /**
+   * \brief Get the valid columns of the word, from column 0.
+   */
+  const unsigned char* get_valid() const;
+};
+
+inline size_t DLQuery::compute(DLRow* rows,
+                               const DLRow* grandparent,
+                               const char* str,
+                               size_t length) const
+{
+  return _kernel(*this, rows, grandparent, str, length);
+}
+
+inline const unsigned char* DLQuery::get_chars() const
+{
+  return _chars.data() + DL_BAND_WIDTH;
+}
+
+inline const unsigned char* DLQuery::get_valid() const
+{
+  return _valid.data() + DL_BAND_WIDTH;
+}
+
 # endif /* !DL_ROW_HH */
@@ -1,59 +1,134 @@
+#include <pthread.h>
+#include <signal.h>
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
 #include <cstdlib>
-#include <climits>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
+#include <thread>
 #include <iostream>
-#include "ptrie.hh"
-#include "approx.hh"
+#include "protocol.hh"
+#include "shards.hh"
+
+static void usage(const char* name)
+{
+  std::cerr << "usage: " << name
+            << " [--binary] [--prefault] [--max-edges N] [--max-rows N] [--deadline MS]"
+            << " /path/to/dict.bin[:weight[:tag]]..." << std::endl;
+}
+
+/*
+ * Parses the value of a limit option, which must be a decimal number.
+ */
+static bool parse_limit(const char* arg, unsigned long& value)
+{
+  if (!isdigit(static_cast<unsigned char>(*arg)))
+    return false;
+
+  char* end;
+  errno = 0;
+  value = strtoul(arg, &end, 10);
+  return *end == '\0' && errno != ERANGE;
+}
 
 int main(int argc, char* argv[])
 {
-  if (argc != 2)
+  bool binary = false;
+  bool prefault = false;
+  s_limits limits = {0, 0, 0};
+  int i;
+
+  for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i)
+  {
+    bool valid = true;
+
+    if (strcmp(argv[i], "--binary") == 0)
+      binary = true;
+    else if (strcmp(argv[i], "--prefault") == 0)
+      prefault = true;
+    else if (strcmp(argv[i], "--max-edges") == 0 && i + 1 < argc)
+      valid = parse_limit(argv[++i], limits.edges);
+    else if (strcmp(argv[i], "--max-rows") == 0 && i + 1 < argc)
+      valid = parse_limit(argv[++i], limits.rows);
+    else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc)
+      valid = parse_limit(argv[++i], limits.deadline);
+    else
+      valid = false;
+
+    if (!valid)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (i == argc)
   {
-    std::cerr << "usage: " << argv[0] << " /path/to/dict.bin" << std::endl;
+    usage(argv[0]);
     return 1;
   }
 
-  s_trie* trie = load(argv[1]);
+  // SIGHUP is only handled by the hangup thread, block it before starting any thread.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-  if (trie == NULL)
-    return 1;
+  ShardSet shards(prefault);
 
-  Approx approx(trie);
+  for (; i < argc; ++i)
+    if (!shards.add(argv[i]))
+      return 1;
 
-  std::string line;
-  size_t delimiter;
+  // Reload all the tries on SIGHUP.
+  std::atomic<bool> stop(false);
+  std::thread hangup([&]
+                     {
+                       int sig;
+                       while (sigwait(&signals, &sig) == 0 && !stop)
+                         shards.reload();
+                     });
 
-  while (std::getline(std::cin, line))
-  {
-    // Get the command.
-    delimiter = line.find_first_of(' ');
-    if (delimiter == std::string::npos)
-      continue;
+  std::unique_ptr<Protocol> protocol;
 
-    std::string cmd(line, 0, delimiter);
-    if (cmd != "approx")
-      continue;
-    line.erase(0, delimiter + 1);
+  if (binary)
+    protocol.reset(new BinaryProtocol());
+  else
+    protocol.reset(new TextProtocol());
 
-    // Get the maximal distance.
-    delimiter = line.find_first_of(' ');
-    if (delimiter == std::string::npos)
-      continue;
+  Query query;
 
-    std::string strdist(line, 0, delimiter);
-    char* offset;
-    unsigned long dist = strtoul(strdist.c_str(), &offset, 10);
-    if (offset == strdist.c_str() || dist == ULONG_MAX)
+  while (protocol->read(query))
+  {
+    // A reload is answered once the new trie is mapped, with an empty result or an error.
+    if (query.command == Query::RELOAD)
+    {
+      if (shards.reload(query.word))
+        protocol->write(std::vector<Approx::Result>(), false);
+      else
+        protocol->write_error("cannot reload " + query.word);
       continue;
+    }
 
-    // Get the word to approximate.
-    line.erase(0, delimiter + 1);
-    if (line.empty())
-      continue;
+    // The limits of the query override the default ones.
+    if (query.limits.edges == 0)
+      query.limits.edges = limits.edges;
+    if (query.limits.rows == 0)
+      query.limits.rows = limits.rows;
+    if (query.limits.deadline == 0)
+      query.limits.deadline = limits.deadline;
 
-    approx.search(line, dist);
+    const std::vector<Approx::Result>& results = shards.search(query);
+    protocol->write(results, shards.is_truncated());
   }
 
-  unload(trie);
+  stop = true;
+  pthread_kill(hangup.native_handle(), SIGHUP);
+  hangup.join();
+
   return 0;
 }
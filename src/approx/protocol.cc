@@ -0,0 +1,376 @@
+#include "protocol.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/*
+ * Size of the chunks read from the standard input and written on the standard output.
+ */
+static const size_t g_chunk_size = 1 << 16;
+
+Protocol::~Protocol()
+{
+}
+
+bool TextProtocol::next_token()
+{
+  size_t delimiter = _line.find_first_of(' ');
+  if (delimiter == std::string::npos)
+    return false;
+
+  _token.assign(_line, 0, delimiter);
+  _line.erase(0, delimiter + 1);
+  return true;
+}
+
+bool TextProtocol::next_number(unsigned int& value)
+{
+  if (!next_token())
+    return false;
+
+  char* offset;
+  unsigned long n = strtoul(_token.c_str(), &offset, 10);
+  if (offset == _token.c_str() || n > UINT_MAX)
+    return false;
+
+  value = n;
+  return true;
+}
+
+bool TextProtocol::next_limits(s_limits& limits)
+{
+  limits = {0, 0, 0};
+
+  for (;;)
+  {
+    size_t delimiter = _line.find_first_of(' ');
+    size_t equal = _line.find_first_of('=');
+
+    if (delimiter == std::string::npos || equal == std::string::npos || equal > delimiter)
+      return true;
+
+    std::string name(_line, 0, equal);
+    char* offset;
+    unsigned long value = strtoul(_line.c_str() + equal + 1, &offset, 10);
+
+    if (offset != _line.c_str() + delimiter)
+      return false;
+
+    if (name == "edges")
+      limits.edges = value;
+    else if (name == "rows")
+      limits.rows = value;
+    else if (name == "deadline")
+      limits.deadline = value;
+    else
+      return false;
+
+    _line.erase(0, delimiter + 1);
+  }
+}
+
+bool TextProtocol::read(Query& query)
+{
+  while (std::getline(std::cin, _line))
+  {
+    // Get the command.
+    if (!next_token())
+      continue;
+
+    if (_token == "approx")
+    {
+      query.command = Query::APPROX;
+
+      // Get the limits.
+      if (!next_limits(query.limits))
+        continue;
+    }
+    else if (_token == "approx-nearest")
+    {
+      query.command = Query::NEAREST;
+
+      // Get the limits and the number of words.
+      if (!next_limits(query.limits) || !next_number(query.count))
+        continue;
+    }
+    else if (_token == "reload")
+    {
+      // Get the path of the trie.
+      if (_line.empty())
+        continue;
+
+      query.command = Query::RELOAD;
+      query.word.swap(_line);
+      return true;
+    }
+    else
+      continue;
+
+    // Get the maximal distance.
+    if (!next_number(query.max_dist))
+      continue;
+
+    // Get the word to approximate.
+    if (_line.empty())
+      continue;
+
+    query.word.swap(_line);
+    return true;
+  }
+
+  return false;
+}
+
+void TextProtocol::write(const std::vector<Approx::Result>& results, bool truncated)
+{
+  if (truncated)
+    printf("{\"truncated\":true,\"results\":");
+
+  printf("[");
+
+  for (auto it = results.cbegin(); it != results.cend(); ++it)
+  {
+    if (it != results.cbegin())
+      printf(",");
+
+    printf("{\"word\":\"%s\",\"freq\":%lu,\"distance\":%u",
+           it->get_word().c_str(), it->get_frequency(), it->get_distance());
+
+    if (it->get_tag() != nullptr)
+      printf(",\"tag\":\"%s\"", it->get_tag()->c_str());
+
+    printf("}");
+  }
+
+  printf(truncated ? "]}\n" : "]\n");
+}
+
+void TextProtocol::write_error(const std::string& message)
+{
+  printf("{\"error\":\"%s\"}\n", message.c_str());
+}
+
+BinaryProtocol::BinaryProtocol()
+  : _in(g_chunk_size)
+  , _in_begin(0)
+  , _in_end(0)
+{
+  _out.reserve(g_chunk_size);
+}
+
+BinaryProtocol::~BinaryProtocol()
+{
+  flush();
+}
+
+bool BinaryProtocol::fill(size_t size)
+{
+  if (_in_end - _in_begin >= size)
+    return true;
+
+  // Move the partial frame at the beginning of the buffer.
+  std::memmove(_in.data(), _in.data() + _in_begin, _in_end - _in_begin);
+  _in_end -= _in_begin;
+  _in_begin = 0;
+
+  if (_in.size() < size)
+    _in.resize(size);
+
+  // We are about to block: the client is waiting for the pending responses.
+  flush();
+
+  while (_in_end < size)
+  {
+    ssize_t n = ::read(STDIN_FILENO, _in.data() + _in_end, _in.size() - _in_end);
+
+    if (n == 0)
+      return false;
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "read failed." << std::endl;
+      return false;
+    }
+
+    _in_end += n;
+  }
+
+  return true;
+}
+
+bool BinaryProtocol::skip(size_t size)
+{
+  while (size > 0)
+  {
+    size_t chunk = std::min(size, g_chunk_size);
+
+    if (!fill(chunk))
+      return false;
+
+    _in_begin += chunk;
+    size -= chunk;
+  }
+
+  return true;
+}
+
+void BinaryProtocol::flush()
+{
+  size_t done = 0;
+
+  while (done < _out.size())
+  {
+    ssize_t n = ::write(STDOUT_FILENO, _out.data() + done, _out.size() - done);
+
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "write failed." << std::endl;
+      break;
+    }
+
+    done += n;
+  }
+
+  _out.clear();
+}
+
+void BinaryProtocol::append(const void* data, size_t size)
+{
+  const char* bytes = (const char*) data;
+  _out.insert(_out.end(), bytes, bytes + size);
+}
+
+bool BinaryProtocol::read(Query& query)
+{
+  uint32_t length;
+  uint8_t command;
+  uint8_t max_dist;
+  uint32_t count;
+  uint64_t edges;
+  uint64_t rows;
+  uint32_t deadline;
+  const size_t header_size = sizeof (command) + sizeof (max_dist) + sizeof (count);
+  const size_t limits_size = sizeof (edges) + sizeof (rows) + sizeof (deadline);
+
+  for (;;)
+  {
+    if (!fill(sizeof (length)))
+      return false;
+
+    std::memcpy(&length, _in.data() + _in_begin, sizeof (length));
+    _in_begin += sizeof (length);
+
+    if (length > BINARY_MAX_FRAME)
+    {
+      if (!skip(length))
+        return false;
+
+      write_error("frame too long");
+      continue;
+    }
+
+    if (!fill(length))
+      return false;
+
+    const char* frame = _in.data() + _in_begin;
+    _in_begin += length;
+
+    if (length <= header_size)
+    {
+      write_error("malformed frame");
+      continue;
+    }
+
+    std::memcpy(&command, frame, sizeof (command));
+    frame += sizeof (command);
+    std::memcpy(&max_dist, frame, sizeof (max_dist));
+    frame += sizeof (max_dist);
+    std::memcpy(&count, frame, sizeof (count));
+    frame += sizeof (count);
+
+    size_t size = length - header_size;
+    query.limits = {0, 0, 0};
+
+    // Get the limits.
+    if (command & 0x80)
+    {
+      if (size <= limits_size)
+      {
+        write_error("malformed frame");
+        continue;
+      }
+
+      std::memcpy(&edges, frame, sizeof (edges));
+      frame += sizeof (edges);
+      std::memcpy(&rows, frame, sizeof (rows));
+      frame += sizeof (rows);
+      std::memcpy(&deadline, frame, sizeof (deadline));
+      frame += sizeof (deadline);
+
+      query.limits = {edges, rows, deadline};
+      size -= limits_size;
+      command &= ~0x80;
+    }
+
+    if (command != Query::APPROX && command != Query::NEAREST && command != Query::RELOAD)
+    {
+      write_error("unknown command");
+      continue;
+    }
+
+    query.command = (Query::Command) command;
+    query.max_dist = max_dist;
+    query.count = count;
+    query.word.assign(frame, size);
+    return true;
+  }
+}
+
+void BinaryProtocol::write(const std::vector<Approx::Result>& results, bool truncated)
+{
+  uint32_t count = results.size() | (truncated ? 0x80000000 : 0);
+  append(&count, sizeof (count));
+
+  for (const Approx::Result& res: results)
+  {
+    uint16_t length = res.get_word().length();
+    uint64_t frequency = res.get_frequency();
+    uint8_t distance = res.get_distance();
+    uint8_t tag_length = res.get_tag() != nullptr ? res.get_tag()->length() : 0;
+
+    append(&length, sizeof (length));
+    append(res.get_word().data(), length);
+    append(&frequency, sizeof (frequency));
+    append(&distance, sizeof (distance));
+    append(&tag_length, sizeof (tag_length));
+    if (tag_length > 0)
+      append(res.get_tag()->data(), tag_length);
+  }
+
+  if (_out.size() >= g_chunk_size)
+    flush();
+}
+
+void BinaryProtocol::write_error(const std::string& message)
+{
+  uint32_t error = 0x40000000;
+  uint16_t length = std::min(message.length(), (size_t) UINT16_MAX);
+
+  append(&error, sizeof (error));
+  append(&length, sizeof (length));
+  append(message.data(), length);
+
+  if (_out.size() >= g_chunk_size)
+    flush();
+}
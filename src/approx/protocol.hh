@@ -0,0 +1,206 @@
+#ifndef PROTOCOL_HH
+# define PROTOCOL_HH
+
+# include <string>
+# include <vector>
+
+# include "approx.hh"
+
+/*
+ * The maximal length of a binary frame.
+ */
+# define BINARY_MAX_FRAME (1 << 16)
+
+/**
+ * \brief A query read by a protocol.
+ */
+struct Query
+{
+  enum Command
+  {
+    APPROX = 0,
+    NEAREST = 1,
+    RELOAD = 2
+  };
+
+  Command command;
+  unsigned int max_dist;
+
+  /*
+   * Number of words to find (NEAREST only).
+   */
+  unsigned int count;
+
+  /*
+   * The word to approximate, or the path of the trie to load (RELOAD).
+   */
+  std::string word;
+
+  /*
+   * The work limits of the query, 0 means the default ones.
+   */
+  s_limits limits;
+};
+
+/**
+ * \brief Protocol class.
+ *
+ * A protocol reads the queries from the standard input and writes
+ * the results on the standard output.
+ */
+class Protocol
+{
+public:
+  virtual ~Protocol();
+
+  /**
+   * \brief Read the next valid query.
+   *
+   * Malformed queries are skipped, a protocol that matches the responses
+   * to the queries by their order answers them with an error.
+   *
+   * \param query A reference to a query that will hold the result.
+   * \return true on success, false at the end of the input.
+   */
+  virtual bool read(Query& query) = 0;
+
+  /**
+   * \brief Write the results of a query.
+   *
+   * \param results The ordered results.
+   * \param truncated Whether a work limit stopped the search.
+   */
+  virtual void write(const std::vector<Approx::Result>& results, bool truncated) = 0;
+
+  /**
+   * \brief Write the response to a query that failed.
+   *
+   * \param message The reason of the failure.
+   */
+  virtual void write_error(const std::string& message) = 0;
+};
+
+/**
+ * \brief Text protocol.
+ *
+ * One query per line:
+ * - approx [<limit>=<value>...] <maximal distance> <word>
+ * - approx-nearest [<limit>=<value>...] <number of words> <maximal distance> <word>
+ * - reload <path>
+ *
+ * The limits are "edges", "rows" and "deadline" (in milliseconds).
+ *
+ * The results are written as a JSON array followed by a newline, for example:
+ * [{"word":"test","freq":49216987,"distance":0},{"word":"est","freq":1991137112,"distance":1}]
+ * The results coming from a tagged dictionary also have a "tag" member.
+ * When a limit stopped the search, the array is wrapped in an object:
+ * {"truncated":true,"results":[...]}
+ * A failed query (e.g. a reload) is answered with an object: {"error":"<message>"}
+ */
+class TextProtocol : public Protocol
+{
+public:
+  bool read(Query& query);
+  void write(const std::vector<Approx::Result>& results, bool truncated);
+  void write_error(const std::string& message);
+
+private:
+  std::string _line;
+  std::string _token;
+
+  /**
+   * \brief Extract the next space separated token from the line.
+   *
+   * The token and its delimiter are erased from the line.
+   *
+   * \return true on success, false if the line has no more delimiter.
+   */
+  bool next_token();
+
+  /**
+   * \brief Extract the next number from the line.
+   *
+   * \param value A reference to a number that will hold the value.
+   * \return true on success, false otherwise.
+   */
+  bool next_number(unsigned int& value);
+
+  /**
+   * \brief Extract the limits from the line.
+   *
+   * \param limits A reference to the limits that will hold the result.
+   * \return true on success, false if a limit is malformed.
+   */
+  bool next_limits(s_limits& limits);
+};
+
+/**
+ * \brief Binary protocol.
+ *
+ * All integers are in the native byte order. A query is a frame:
+ * - uint32 length of the frame, this field excluded;
+ * - uint8 command (0: approx, 1: approx-nearest, 2: reload), ored with 0x80
+ *   when the limits follow;
+ * - uint8 maximal distance;
+ * - uint32 number of words (approx-nearest only, ignored otherwise);
+ * - the limits, if any: uint64 edges, uint64 rows and uint32 deadline (in milliseconds);
+ * - the bytes of the word, or of the path for reload (the rest of the frame).
+ *
+ * A frame is at most BINARY_MAX_FRAME bytes long. Every frame gets a response,
+ * so a frame that is too long or malformed is answered with an error.
+ *
+ * The response to a query is:
+ * - uint32 number of results, ored with 0x80000000 when a limit stopped the search;
+ * - for each result: uint16 word length, the bytes of the word,
+ *   uint64 frequency, uint8 distance, uint8 tag length and the bytes of the tag.
+ *
+ * The response to a query that failed is the uint32 0x40000000 followed by
+ * a uint16 message length and the bytes of the message.
+ *
+ * The input is read and the output is written by large chunks. The pending
+ * responses are flushed before blocking to read more queries.
+ */
+class BinaryProtocol : public Protocol
+{
+public:
+  BinaryProtocol();
+  ~BinaryProtocol();
+
+  bool read(Query& query);
+  void write(const std::vector<Approx::Result>& results, bool truncated);
+  void write_error(const std::string& message);
+
+private:
+  std::vector<char> _in;
+  size_t _in_begin;
+  size_t _in_end;
+  std::vector<char> _out;
+
+  /**
+   * \brief Make sure that size bytes are available in the input buffer.
+   *
+   * \param size The number of bytes.
+   * \return true on success, false at the end of the input.
+   */
+  bool fill(size_t size);
+
+  /**
+   * \brief Skip bytes of the input, without holding them in the input buffer.
+   *
+   * \param size The number of bytes.
+   * \return true on success, false at the end of the input.
+   */
+  bool skip(size_t size);
+
+  /**
+   * \brief Write the output buffer on the standard output.
+   */
+  void flush();
+
+  /**
+   * \brief Append bytes to the output buffer.
+   */
+  void append(const void* data, size_t size);
+};
+
+# endif /* !PROTOCOL_HH */
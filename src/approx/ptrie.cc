@@ -6,8 +6,7 @@
 #include <sys/mman.h>
 
 #include <iostream>
-
-static size_t g_data_size = 0;
+#include <string>
 
 s_trie* load(const char* filename)
 {
@@ -29,8 +28,7 @@ s_trie* load(const char* filename)
   }
 
   // Map file in memory
-  g_data_size = sbuf.st_size;
-  void* map = mmap(0, g_data_size, PROT_READ, MAP_SHARED, fd, 0);
+  void* map = mmap(0, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
 
   if (map == MAP_FAILED)
   {
@@ -38,7 +36,10 @@ s_trie* load(const char* filename)
     return NULL;
   }
 
-  s_trie* trie = (s_trie*) map;
+  s_trie* trie = new s_trie;
+  trie->data = map;
+  trie->size = sbuf.st_size;
+  trie->qgram = NULL;
 
   // Close file.
   if (close(fd) == -1)
@@ -48,31 +49,78 @@ s_trie* load(const char* filename)
     return NULL;
   }
 
+  const s_header* header = (const s_header*) map;
+
+  if (trie->size >= sizeof (s_header) && header->magic == TRIE_MAGIC)
+  {
+    const unsigned long long* build_id = (const unsigned long long*) (header + 1);
+
+    trie->flags = header->flags;
+    trie->build_id = (trie->flags & TRIE_BUILD_ID) ? *build_id : 0;
+    trie->strs = (const char*) ((trie->flags & TRIE_BUILD_ID) ? build_id + 1 : build_id);
+
+    // The edges are aligned after the char sequences.
+    size_t align = (trie->flags & TRIE_WIDE_OFFSETS) ? alignof (s_wide_edge) : alignof (s_edge);
+    size_t edges = (trie->strs - (const char*) map) + header->length;
+    edges += (align - edges % align) % align;
+    trie->root = (const char*) map + edges;
+  }
+  else
+  {
+    const unsigned int* length = (const unsigned int*) map;
+
+    trie->flags = 0;
+    trie->build_id = 0;
+    trie->strs = (const char*) (length + 1);
+    trie->root = trie->strs + *length;
+  }
+
   return trie;
 }
 
+void load_index(s_trie* trie, const char* filename)
+{
+  trie->qgram = load_qgram((std::string(filename) + ".qgram").c_str(), trie->build_id);
+}
+
 bool unload(s_trie* trie)
 {
-  if (munmap(trie, g_data_size) == -1)
+  bool res = true;
+
+  if (munmap(trie->data, trie->size) == -1)
   {
     std::cerr << "munmap failed." << std::endl;
-    return false;
+    res = false;
   }
 
-  return true;
+  if (trie->qgram != NULL && !unload_qgram(trie->qgram))
+    res = false;
+
+  delete trie;
+  return res;
 }
 
-const s_edge* get_root(const s_trie* trie)
+static void prefault(void* map, size_t size)
 {
-  return (const s_edge*) (&trie->strs + trie->length);
+  long page = sysconf(_SC_PAGESIZE);
+
+  madvise(map, size, MADV_WILLNEED);
+
+  // Touch one byte per page.
+  const volatile char* data = (const volatile char*) map;
+  for (size_t i = 0; i < size; i += page)
+    (void) data[i];
 }
 
-const s_edge* get_child(const s_edge* edge)
+void prefault(const s_trie* trie)
 {
-  return edge + edge->children_offset;
+  prefault(trie->data, trie->size);
+
+  if (trie->qgram != NULL)
+    prefault(trie->qgram->data, trie->qgram->size);
 }
 
-const char* get_str(const s_trie* trie, unsigned int offset)
+const char* get_str(const s_trie* trie, unsigned long long offset)
 {
-  return &trie->strs + offset;
+  return trie->strs + offset;
 }
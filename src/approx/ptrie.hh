@@ -1,29 +1,47 @@
 #ifndef PTRIE_HH
 # define PTRIE_HH
 
-typedef struct
-{
-  unsigned int length;
-  char strs;
-} s_trie;
+# include <cstddef>
 
-typedef struct
+# include "common/format.hh"
+# include "qgram.hh"
+
+typedef struct s_trie
 {
-  unsigned int offset;
-  unsigned int length;
-  unsigned int frequency;
-  unsigned int children_count;
-  unsigned int children_offset;
-} s_edge;
+  void* data;
+  size_t size;
+  unsigned int flags;
+
+  // The build id of the trie, 0 if the file has none.
+  unsigned long long build_id;
+
+  const char* strs;
+
+  // The q-gram index of the trie, if any.
+  s_qgram* qgram;
+
+  // The virtual root edge, either a s_edge or a s_wide_edge.
+  const void* root;
+} s_trie;
 
 /**
  * \brief Load the trie.
  *
+ * The file is only mapped and its header checked, it is not read.
+ *
  * \param filename The path to the serialized trie.
  * \return On success, a pointer to the trie struct, NULL pointer otherwise.
  */
 s_trie* load(const char* filename);
 
+/**
+ * \brief Load the q-gram index "<filename>.qgram" of the trie, if it exists.
+ *
+ * \param trie The trie.
+ * \param filename The path to the serialized trie.
+ */
+void load_index(s_trie* trie, const char* filename);
+
 /**
  * \brief Unload the trie.
  *
@@ -32,13 +50,24 @@ s_trie* load(const char* filename);
  */
 bool unload(s_trie* trie);
 
+/**
+ * \brief Read the whole trie in memory.
+ *
+ * It faults in all the pages of the mapping, so the first searches do not
+ * pay for it.
+ *
+ * \param trie The trie.
+ */
+void prefault(const s_trie* trie);
+
 /**
  * \brief Get the root edge of the trie.
  *
  * \param trie The trie.
  * \return A pointer to the root edge.
  */
-const s_edge* get_root(const s_trie* trie);
+template <typename Edge>
+const Edge* get_root(const s_trie* trie);
 
 /**
  * \brief Get the child of an edge.
@@ -46,7 +75,8 @@ const s_edge* get_root(const s_trie* trie);
  * \param edge The edge to get the child of.
  * \return A pointer to the leftmost child edge.
  */
-const s_edge* get_child(const s_edge* edge);
+template <typename Edge>
+const Edge* get_child(const Edge* edge);
 
 /**
  * \brief Get a char sequence.
@@ -55,6 +85,18 @@ const s_edge* get_child(const s_edge* edge);
  * \param offset The offset of the char sequence.
  * \return A pointer to the char sequence in the sequence buffer.
  */
-const char* get_str(const s_trie* trie, unsigned int offset);
+const char* get_str(const s_trie* trie, unsigned long long offset);
+
+/**
+ * \brief Get the char sequence of an edge.
+ *
+ * \param trie The trie.
+ * \param edge The edge.
+ * \return A pointer to the char sequence, either inlined in the edge or in the sequence buffer.
+ */
+template <typename Edge>
+const char* get_label(const s_trie* trie, const Edge* edge);
+
+# include "ptrie.hxx"
 
 # endif /* !PTRIE_HH */
@@ -0,0 +1,27 @@
+#ifndef PTRIE_HXX
+# define PTRIE_HXX
+
+# include "ptrie.hh"
+
+template <typename Edge>
+const Edge* get_root(const s_trie* trie)
+{
+  return (const Edge*) trie->root;
+}
+
+template <typename Edge>
+const Edge* get_child(const Edge* edge)
+{
+  return edge + edge->children_offset;
+}
+
+template <typename Edge>
+const char* get_label(const s_trie* trie, const Edge* edge)
+{
+  if ((trie->flags & TRIE_INLINE_LABELS) && edge->length <= sizeof (edge->offset))
+    return (const char*) &edge->offset;
+
+  return get_str(trie, edge->offset);
+}
+
+# endif /* !PTRIE_HXX */
@@ -0,0 +1,191 @@
+#include "qgram.hh"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+
+/**
+ * \brief Check that the sections of an index fit in the file.
+ *
+ * \param index The index, with its header.
+ * \return true if the index is consistent, false otherwise.
+ */
+static bool check_sections(const s_qgram* index)
+{
+  const s_qgram_header* header = index->header;
+  size_t remaining = index->size - sizeof (s_qgram_header);
+
+  if (header->word_count > remaining / sizeof (s_qgram_word))
+    return false;
+  remaining -= header->word_count * sizeof (s_qgram_word);
+
+  if (header->gram_count > remaining / sizeof (s_qgram_entry))
+    return false;
+  remaining -= header->gram_count * sizeof (s_qgram_entry);
+
+  if (header->chars_length > remaining)
+    return false;
+  remaining -= header->chars_length;
+
+  if (header->postings_length > remaining)
+    return false;
+
+  return true;
+}
+
+/**
+ * \brief Check that the words and the posting lists stay in their sections.
+ *
+ * The posting lists are not decoded here, Approx checks their ids while
+ * decoding them (see postings_end()).
+ *
+ * \param index The index, with its sections.
+ * \return true if the index is consistent, false otherwise.
+ */
+static bool check_bounds(const s_qgram* index)
+{
+  const s_qgram_header* header = index->header;
+
+  for (unsigned long long i = 0; i < header->word_count; ++i)
+    if (index->words[i].offset > header->chars_length
+        || index->words[i].length > header->chars_length - index->words[i].offset)
+      return false;
+
+  for (unsigned long long i = 0; i < header->gram_count; ++i)
+  {
+    const s_qgram_entry& entry = index->grams[i];
+
+    // The q-grams are sorted and their lists follow each other.
+    if (i > 0 && (entry.gram <= index->grams[i - 1].gram || entry.offset < index->grams[i - 1].offset))
+      return false;
+    if (entry.offset > header->postings_length)
+      return false;
+
+    // Each id takes at least one byte.
+    if (entry.count > (size_t) (postings_end(index, &entry) - index->postings) - entry.offset)
+      return false;
+  }
+
+  return true;
+}
+
+s_qgram* load_qgram(const char* filename, unsigned long long trie_build_id)
+{
+  int fd;
+  struct stat sbuf;
+
+  // Open file, the index is optional.
+  if ( (fd = open(filename, O_RDONLY)) == -1)
+  {
+    if (errno != ENOENT)
+      std::cerr << "open failed." << std::endl;
+    return NULL;
+  }
+
+  // Get file size.
+  if (fstat(fd, &sbuf) == -1 || (size_t) sbuf.st_size < sizeof (s_qgram_header))
+  {
+    std::cerr << "stat failed." << std::endl;
+    close(fd);
+    return NULL;
+  }
+
+  // Map file in memory
+  void* map = mmap(0, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+  {
+    std::cerr << "mmap failed." << std::endl;
+    return NULL;
+  }
+
+  s_qgram* index = new s_qgram;
+  index->data = map;
+  index->size = sbuf.st_size;
+  index->header = (const s_qgram_header*) map;
+
+  if (index->header->magic != QGRAM_MAGIC)
+  {
+    std::cerr << filename << ": not a q-gram index." << std::endl;
+    unload_qgram(index);
+    return NULL;
+  }
+
+  // The index of a previous version of the trie must not be used.
+  if (trie_build_id == 0 || index->header->trie_build_id != trie_build_id)
+  {
+    std::cerr << filename << ": built for another trie, ignored." << std::endl;
+    unload_qgram(index);
+    return NULL;
+  }
+
+  if (index->header->q == 0 || index->header->q > QGRAM_MAX_Q)
+  {
+    std::cerr << filename << ": invalid q-gram length." << std::endl;
+    unload_qgram(index);
+    return NULL;
+  }
+
+  if (!check_sections(index))
+  {
+    std::cerr << filename << ": truncated q-gram index." << std::endl;
+    unload_qgram(index);
+    return NULL;
+  }
+
+  index->words = (const s_qgram_word*) (index->header + 1);
+  index->grams = (const s_qgram_entry*) (index->words + index->header->word_count);
+  index->chars = (const char*) (index->grams + index->header->gram_count);
+  index->postings = (const unsigned char*) (index->chars + index->header->chars_length);
+
+  if (!check_bounds(index))
+  {
+    std::cerr << filename << ": corrupted q-gram index." << std::endl;
+    unload_qgram(index);
+    return NULL;
+  }
+
+  return index;
+}
+
+bool unload_qgram(s_qgram* index)
+{
+  bool res = true;
+
+  if (munmap(index->data, index->size) == -1)
+  {
+    std::cerr << "munmap failed." << std::endl;
+    res = false;
+  }
+
+  delete index;
+  return res;
+}
+
+const s_qgram_entry* find_gram(const s_qgram* index, unsigned long long gram)
+{
+  const s_qgram_entry* begin = index->grams;
+  const s_qgram_entry* end = begin + index->header->gram_count;
+  const s_qgram_entry* it = std::lower_bound(begin, end, gram,
+                                             [](const s_qgram_entry& e, unsigned long long g)
+                                             {
+                                               return e.gram < g;
+                                             });
+
+  return (it != end && it->gram == gram) ? it : NULL;
+}
+
+const unsigned char* postings_end(const s_qgram* index, const s_qgram_entry* entry)
+{
+  const s_qgram_entry* next = entry + 1;
+
+  if (next == index->grams + index->header->gram_count)
+    return index->postings + index->header->postings_length;
+  return index->postings + next->offset;
+}
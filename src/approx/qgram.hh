@@ -0,0 +1,58 @@
+#ifndef QGRAM_HH
+# define QGRAM_HH
+
+# include <cstddef>
+
+# include "common/format.hh"
+
+typedef struct
+{
+  void* data;
+  size_t size;
+  const s_qgram_header* header;
+  const s_qgram_word* words;
+  const s_qgram_entry* grams;
+  const char* chars;
+  const unsigned char* postings;
+} s_qgram;
+
+/**
+ * \brief Load a q-gram index.
+ *
+ * The index is rejected if it was not built for the trie (see s_qgram_header)
+ * or if its sections do not fit in the file.
+ *
+ * \param filename The path to the serialized index.
+ * \param trie_build_id The build id of the trie the index must have been built for.
+ * \return On success, a pointer to the index struct, NULL pointer otherwise
+ * (silently if the file does not exist).
+ */
+s_qgram* load_qgram(const char* filename, unsigned long long trie_build_id);
+
+/**
+ * \brief Unload a q-gram index.
+ *
+ * \param index The index to unload.
+ * \return true on success, false otherwise.
+ */
+bool unload_qgram(s_qgram* index);
+
+/**
+ * \brief Find a q-gram.
+ *
+ * \param index The index.
+ * \param gram The packed q-gram.
+ * \return A pointer to the q-gram entry, NULL pointer if no word contains it.
+ */
+const s_qgram_entry* find_gram(const s_qgram* index, unsigned long long gram);
+
+/**
+ * \brief Get the end of the posting list of a q-gram.
+ *
+ * \param index The index.
+ * \param entry The q-gram entry.
+ * \return A pointer past the last byte of the posting list.
+ */
+const unsigned char* postings_end(const s_qgram* index, const s_qgram_entry* entry);
+
+# endif /* !QGRAM_HH */
@@ -0,0 +1,354 @@
+#include "shards.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+ShardSet::ShardSet(bool prefault)
+  : _truncated(false)
+  , _generation(0)
+  , _pending(0)
+  , _stop(false)
+  , _prefault(prefault)
+  , _reload_stop(false)
+{
+  _reload_thread = std::thread(&ShardSet::reload_work, this);
+}
+
+ShardSet::~ShardSet()
+{
+  {
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    _reload_stop = true;
+  }
+  _reload_work.notify_one();
+  _reload_thread.join();
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _work.notify_all();
+
+  for (auto& shard: _shards)
+    if (shard->thread.joinable())
+      shard->thread.join();
+}
+
+std::shared_ptr<s_trie> ShardSet::open(const std::string& path)
+{
+  s_trie* trie = load(path.c_str());
+
+  if (trie == NULL)
+    return nullptr;
+
+  load_index(trie, path.c_str());
+
+  if (_prefault)
+    prefault(trie);
+
+  return std::shared_ptr<s_trie>(trie, unload);
+}
+
+bool ShardSet::add(const std::string& spec)
+{
+  std::unique_ptr<Shard> shard(new Shard);
+  size_t delimiter = spec.find_first_of(':');
+
+  shard->path.assign(spec, 0, delimiter);
+  shard->weight = 1;
+
+  // Get the weight and the tag.
+  if (delimiter != std::string::npos)
+  {
+    std::string options(spec, delimiter + 1);
+    delimiter = options.find_first_of(':');
+
+    std::string weight(options, 0, delimiter);
+    if (!weight.empty())
+    {
+      char* offset;
+      shard->weight = strtod(weight.c_str(), &offset);
+      if (*offset != '\0' || !std::isfinite(shard->weight) || shard->weight <= 0)
+      {
+        std::cerr << "invalid weight: " << weight << std::endl;
+        return false;
+      }
+    }
+
+    if (delimiter != std::string::npos)
+      shard->tag.assign(options, delimiter + 1, std::string::npos);
+  }
+
+  shard->trie = open(shard->path);
+  if (!shard->trie)
+    return false;
+
+  shard->approx.reset(new Approx(shard->trie.get()));
+
+  // The first shard is searched by the calling thread.
+  if (!_shards.empty())
+    shard->thread = std::thread(&ShardSet::work, this, std::ref(*shard), _generation);
+
+  _shards.push_back(std::move(shard));
+  return true;
+}
+
+void ShardSet::work(Shard& shard, unsigned long generation)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  for (;;)
+  {
+    _work.wait(lock, [&] { return _stop || _generation != generation; });
+
+    if (_stop)
+      return;
+
+    generation = _generation;
+
+    lock.unlock();
+    collect(shard);
+    lock.lock();
+
+    if (--_pending == 0)
+      _done.notify_one();
+  }
+}
+
+void ShardSet::collect(Shard& shard)
+{
+  shard.results.clear();
+
+  Approx::Cursor cursor = shard.approx->open(_word, _min_dist, _max_dist);
+
+  while (cursor.next(shard.results, (size_t) -1))
+  {
+  }
+}
+
+void ShardSet::fan_out(const std::string& word, unsigned int min_dist, unsigned int max_dist)
+{
+  _word = word;
+  _min_dist = min_dist;
+  _max_dist = max_dist;
+
+  if (_shards.size() > 1)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _pending = _shards.size() - 1;
+      ++_generation;
+    }
+    _work.notify_all();
+  }
+
+  collect(*_shards.front());
+
+  if (_shards.size() > 1)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [&] { return _pending == 0; });
+  }
+}
+
+void ShardSet::merge()
+{
+  size_t first = _results.size();
+
+  for (auto& shard: _shards)
+  {
+    _truncated = _truncated || shard->approx->is_truncated();
+
+    for (Approx::Result& res: shard->results)
+    {
+      if (shard->weight != 1)
+      {
+        // Rounded, and saturated rather than converted out of range.
+        double frequency = std::round(res.get_frequency() * shard->weight);
+        res.set_frequency(frequency < (double) ULONG_MAX ? (unsigned long) frequency : ULONG_MAX);
+      }
+      if (!shard->tag.empty())
+        res.set_tag(&shard->tag);
+
+      _results.push_back(std::move(res));
+    }
+  }
+
+  auto begin = _results.begin() + first;
+
+  // Combine the duplicates, the most frequent one gives its tag.
+  if (_shards.size() > 1)
+  {
+    std::sort(begin, _results.end(),
+              [](const Approx::Result& a, const Approx::Result& b)
+              {
+                return a.get_word() < b.get_word()
+                  || (a.get_word() == b.get_word() && a.get_frequency() > b.get_frequency());
+              });
+
+    auto last = begin;
+    for (auto it = begin; it != _results.end(); ++it)
+    {
+      if (it != begin && it->get_word() == (last - 1)->get_word())
+        (last - 1)->set_frequency(std::min((last - 1)->get_frequency(),
+                                           ULONG_MAX - it->get_frequency()) + it->get_frequency());
+      else
+      {
+        if (last != it)
+          *last = std::move(*it);
+        ++last;
+      }
+    }
+
+    _results.erase(last, _results.end());
+  }
+
+  std::sort(begin, _results.end());
+}
+
+const std::vector<Approx::Result>& ShardSet::search(const Query& query)
+{
+  auto now = std::chrono::steady_clock::now();
+  s_limits limits = query.limits;
+
+  // A deadline beyond the range of the clock is no deadline.
+  auto range = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point::max() - now);
+  if (limits.deadline >= static_cast<unsigned long long>(range.count()))
+    limits.deadline = 0;
+
+  auto deadline = now + std::chrono::milliseconds(limits.deadline);
+
+  _results.clear();
+  _truncated = false;
+  _query_work.edges = 0;
+  _query_work.rows = 0;
+
+  // Hold the tries until the end of the query, a reload may swap them meanwhile.
+  for (auto& shard: _shards)
+  {
+    shard->current = std::atomic_load(&shard->trie);
+    shard->approx->set_trie(shard->current.get());
+    shard->approx->set_limits(limits, deadline, &_query_work);
+  }
+
+  switch (query.command)
+  {
+  case Query::APPROX:
+    fan_out(query.word, 0, query.max_dist);
+    merge();
+    break;
+
+  case Query::NEAREST:
+    // Each pass only collects the words lying exactly at the new radius.
+    for (unsigned int dist = 0;
+         dist <= query.max_dist && _results.size() < query.count && !_truncated;
+         ++dist)
+    {
+      fan_out(query.word, dist, dist);
+      merge();
+    }
+
+    if (_results.size() > query.count)
+      _results.erase(_results.begin() + query.count, _results.end());
+    break;
+
+  case Query::RELOAD:
+    break;
+  }
+
+  for (auto& shard: _shards)
+    shard->current.reset();
+
+  return _results;
+}
+
+bool ShardSet::is_truncated() const
+{
+  return _truncated;
+}
+
+bool ShardSet::queue_reload(Shard& shard, const std::string& path)
+{
+  s_trie* trie = load(path.c_str());
+
+  if (trie == NULL)
+    return false;
+
+  shard.path = path;
+  _reloads.push_back({&shard, path, std::shared_ptr<s_trie>(trie, unload)});
+  _reload_work.notify_one();
+
+  return true;
+}
+
+bool ShardSet::reload(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(_reload_mutex);
+  Shard* target = nullptr;
+
+  for (auto& shard: _shards)
+    if (shard->path == path)
+      target = shard.get();
+
+  if (target == nullptr && _shards.size() == 1)
+    target = _shards.front().get();
+
+  if (target == nullptr)
+  {
+    std::cerr << "reload: no trie to replace with " << path << std::endl;
+    return false;
+  }
+
+  return queue_reload(*target, path);
+}
+
+bool ShardSet::reload()
+{
+  std::lock_guard<std::mutex> lock(_reload_mutex);
+  bool success = true;
+
+  for (auto& shard: _shards)
+    success = queue_reload(*shard, shard->path) && success;
+
+  return success;
+}
+
+void ShardSet::reload_work()
+{
+  std::unique_lock<std::mutex> lock(_reload_mutex);
+
+  for (;;)
+  {
+    _reload_work.wait(lock, [&] { return _reload_stop || !_reloads.empty(); });
+
+    if (_reload_stop)
+      return;
+
+    Reload reload = std::move(_reloads.front());
+    _reloads.pop_front();
+
+    lock.unlock();
+    swap(reload);
+    lock.lock();
+  }
+}
+
+void ShardSet::swap(Reload& reload)
+{
+  load_index(reload.trie.get(), reload.path.c_str());
+
+  if (_prefault)
+    prefault(reload.trie.get());
+
+  std::shared_ptr<s_trie> old = std::atomic_exchange(&reload.shard->trie, reload.trie);
+  reload.trie.reset();
+
+  // Grace period: wait for the in-flight query to release the old trie,
+  // so it is unmapped here and not on the query path.
+  while (old.use_count() > 1)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
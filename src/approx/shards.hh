@@ -0,0 +1,230 @@
+#ifndef SHARDS_HH
+# define SHARDS_HH
+
+# include <condition_variable>
+# include <deque>
+# include <memory>
+# include <mutex>
+# include <string>
+# include <thread>
+# include <vector>
+
+# include "ptrie.hh"
+# include "approx.hh"
+# include "protocol.hh"
+
+/**
+ * \brief ShardSet class.
+ *
+ * A set of compiled tries searched together. Each trie (shard) has its own
+ * searcher and, except the first one which is searched by the calling thread,
+ * its own worker thread, so a query searches all the shards in parallel.
+ *
+ * The results of the shards are merged: the frequencies are multiplied by the
+ * weight of their shard and the frequencies of a word found in several shards
+ * are summed. The merged results keep the usual order. The work limits of
+ * a query apply to its work in all the shards.
+ *
+ * The tries can be reloaded while searching: the new trie is mapped and its
+ * header checked right away, then a background thread loads its q-gram index,
+ * prefaults it, swaps it atomically and unmaps the old one once the in-flight
+ * query that still uses it is over.
+ */
+class ShardSet
+{
+public:
+  /**
+   * \brief Construct an empty set.
+   *
+   * \param prefault Whether the tries are read in memory when they are loaded.
+   */
+  ShardSet(bool prefault);
+
+  /**
+   * \brief Stop the workers and unload the tries.
+   */
+  ~ShardSet();
+
+  /**
+   * \brief Load a trie and add it to the set.
+   *
+   * \param spec The path to the serialized trie, optionally followed by
+   * ":<weight>" and ":<tag>" (e.g. "fr.bin:0.5:fr").
+   * \return true on success, false otherwise.
+   */
+  bool add(const std::string& spec);
+
+  /**
+   * \brief Search all the shards.
+   *
+   * For a nearest query, the search radius starts at 0 and is increased by one
+   * until at least count words are found. The results of the previous passes are
+   * kept, so each pass only collects the words lying exactly at the new radius.
+   *
+   * \param query The query.
+   * \return The ordered results, valid until the next search.
+   */
+  const std::vector<Approx::Result>& search(const Query& query);
+
+  /**
+   * \brief Determine whether a work limit stopped the last search.
+   *
+   * The results are then the ones found before the limit was exceeded.
+   */
+  bool is_truncated() const;
+
+  /**
+   * \brief Reload a trie.
+   *
+   * The trie loaded from this path is reloaded. If there is no such trie and
+   * the set holds a single trie, the path replaces it.
+   *
+   * The new trie is mapped before returning, the rest of the reload happens
+   * in the background: the queries use the old trie until it is swapped.
+   *
+   * \param path The path to the serialized trie.
+   * \return true on success, false if the trie cannot be mapped or there is no trie to replace.
+   */
+  bool reload(const std::string& path);
+
+  /**
+   * \brief Reload all the tries from their paths.
+   *
+   * \return true if all the tries were mapped.
+   */
+  bool reload();
+
+private:
+  /**
+   * \brief A trie of the set with its searcher.
+   */
+  struct Shard
+  {
+    std::string path;
+    double weight;
+    std::string tag;
+
+    // The latest trie, accessed atomically.
+    std::shared_ptr<s_trie> trie;
+
+    // The trie used by the current query.
+    std::shared_ptr<s_trie> current;
+    std::unique_ptr<Approx> approx;
+
+    // The results of the current job.
+    std::vector<Approx::Result> results;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::vector<Approx::Result> _results;
+  bool _truncated;
+
+  /*
+   * The work of the current query in all the shards, limited as a whole.
+   */
+  s_work _query_work;
+
+  /*
+   * The current job, protected by _mutex:
+   * - the workers wait on _work for a new generation;
+   * - the caller waits on _done for the pending workers.
+   */
+  std::mutex _mutex;
+  std::condition_variable _work;
+  std::condition_variable _done;
+  unsigned long _generation;
+  size_t _pending;
+  bool _stop;
+
+  std::string _word;
+  unsigned int _min_dist;
+  unsigned int _max_dist;
+
+  /**
+   * \brief A mapped trie waiting to replace the trie of a shard.
+   */
+  struct Reload
+  {
+    Shard* shard;
+    std::string path;
+    std::shared_ptr<s_trie> trie;
+  };
+
+  /*
+   * The pending reloads, protected by _reload_mutex (as the paths of the shards)
+   * and processed by _reload_thread.
+   */
+  bool _prefault;
+  std::mutex _reload_mutex;
+  std::condition_variable _reload_work;
+  std::deque<Reload> _reloads;
+  bool _reload_stop;
+  std::thread _reload_thread;
+
+  /**
+   * \brief Load a trie with its q-gram index and prefault it if required.
+   *
+   * \param path The path to the serialized trie.
+   * \return The trie, or a null pointer on failure.
+   */
+  std::shared_ptr<s_trie> open(const std::string& path);
+
+  /**
+   * \brief Map a new trie for a shard and queue its reload.
+   *
+   * _reload_mutex must be held.
+   *
+   * \param shard The shard.
+   * \param path The path to the new serialized trie.
+   * \return true on success, false if the trie cannot be mapped.
+   */
+  bool queue_reload(Shard& shard, const std::string& path);
+
+  /**
+   * \brief The loop of the reload thread.
+   */
+  void reload_work();
+
+  /**
+   * \brief Swap the trie of a shard with a new one.
+   *
+   * It returns once the old trie is unloaded.
+   *
+   * \param reload The new trie and its shard.
+   */
+  void swap(Reload& reload);
+
+  /**
+   * \brief The loop of a worker thread.
+   *
+   * \param shard The shard of the worker.
+   * \param generation The generation of the last job before the worker started.
+   */
+  void work(Shard& shard, unsigned long generation);
+
+  /**
+   * \brief Run the current job on a shard.
+   *
+   * \param shard The shard.
+   */
+  void collect(Shard& shard);
+
+  /**
+   * \brief Collect the words lying between min_dist and max_dist in all the shards.
+   *
+   * \param word The word to approximate.
+   * \param min_dist The minimal distance.
+   * \param max_dist The maximal distance.
+   */
+  void fan_out(const std::string& word, unsigned int min_dist, unsigned int max_dist);
+
+  /**
+   * \brief Merge the results of the shards after the already merged ones.
+   *
+   * The new results must all be farther than the already merged ones.
+   */
+  void merge();
+};
+
+# endif /* !SHARDS_HH */
@@ -0,0 +1,111 @@
+#ifndef FORMAT_HH
+# define FORMAT_HH
+
+/*
+ * Layout of a compiled trie:
+ * - the header;
+ * - the build id (unsigned long long), if TRIE_BUILD_ID is set;
+ * - the char sequences buffer (header.length bytes);
+ * - padding up to the alignment of the edges;
+ * - the edges, starting with the virtual root edge. The children of an edge
+ *   are contiguous and stored after it.
+ *
+ * Files without the magic number use the legacy layout: an unsigned int
+ * holding the length of the char sequences buffer, the buffer and the edges.
+ */
+
+/*
+ * Magic number of a compiled trie ("ASTR").
+ */
+# define TRIE_MAGIC 0x52545341
+
+/*
+ * Char sequences that fit in the offset field of an edge are stored in place
+ * of the offset instead of the char sequences buffer.
+ */
+# define TRIE_INLINE_LABELS 0x1
+
+/*
+ * The edges are made of 64-bit fields (s_wide_edge) instead of 32-bit ones (s_edge).
+ * It is required when the char sequences buffer or a frequency exceeds 2^32 - 1.
+ */
+# define TRIE_WIDE_OFFSETS 0x2
+
+/*
+ * The header is followed by a random id generated when the trie is written,
+ * it ties the q-gram index to the trie.
+ */
+# define TRIE_BUILD_ID 0x4
+
+typedef struct
+{
+  unsigned int magic;
+  unsigned int flags;
+  unsigned long long length;
+} s_header;
+
+template <typename T>
+struct s_basic_edge
+{
+  typedef T value_type;
+
+  T offset;
+  T length;
+  T frequency;
+  T children_count;
+  T children_offset;
+};
+
+typedef s_basic_edge<unsigned int> s_edge;
+typedef s_basic_edge<unsigned long long> s_wide_edge;
+
+/*
+ * Layout of a q-gram index (the optional "<trie>.qgram" file):
+ * - the header, with the build id of the trie it was built for;
+ * - the words (header.word_count s_qgram_word), the word ids are their indexes;
+ * - the q-grams (header.gram_count s_qgram_entry), by increasing value;
+ * - the chars of the words (header.chars_length bytes);
+ * - the posting lists (header.postings_length bytes).
+ *
+ * A q-gram is packed in an integer, its first char in the most significant used byte.
+ * A posting list holds the ids of the words containing the q-gram, once per occurrence,
+ * by increasing value. They are delta encoded as variable length integers: 7 bits per
+ * byte, least significant first, the high bit set on all bytes but the last.
+ */
+
+/*
+ * Magic number of a q-gram index ("ASQ3").
+ */
+# define QGRAM_MAGIC 0x33515341
+
+/*
+ * Maximal length of a q-gram.
+ */
+# define QGRAM_MAX_Q 8
+
+typedef struct
+{
+  unsigned int magic;
+  unsigned int q;
+  unsigned long long word_count;
+  unsigned long long gram_count;
+  unsigned long long chars_length;
+  unsigned long long postings_length;
+  unsigned long long trie_build_id;
+} s_qgram_header;
+
+typedef struct
+{
+  unsigned long long offset;
+  unsigned long long frequency;
+  unsigned long long length;
+} s_qgram_word;
+
+typedef struct
+{
+  unsigned long long gram;
+  unsigned long long offset;
+  unsigned long long count;
+} s_qgram_entry;
+
+# endif /* !FORMAT_HH */
@@ -1,19 +1,124 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include "merge.hh"
 #include "ptrie.hh"
+#include "qgram.hh"
 
-int main(int argc, char* argv[])
+static void usage(const char* name)
+{
+  std::cerr << "usage: " << name
+            << " [--inline-labels] [--wide-offsets] [--profile /path/to/queries.txt] [--qgram Q]"
+            << " /path/to/words.txt /path/to/dict.bin" << std::endl
+            << "       " << name
+            << " --merge [--duplicates sum|max|first] [--inline-labels] [--wide-offsets] [--qgram Q]"
+            << " /path/to/a.bin /path/to/b.bin... /path/to/dict.bin" << std::endl;
+}
+
+/**
+ * \brief Parse the value of the --duplicates option.
+ *
+ * \param name The name of the policy: "sum", "max" or "first".
+ * \param policy A reference to the policy that will hold the result.
+ * \return true on success, false if the name is unknown.
+ */
+static bool parse_policy(const char* name, TrieMerger::Policy& policy)
 {
-  if (argc != 3)
+  if (strcmp(name, "sum") == 0)
+    policy = TrieMerger::SUM;
+  else if (strcmp(name, "max") == 0)
+    policy = TrieMerger::MAX;
+  else if (strcmp(name, "first") == 0)
+    policy = TrieMerger::FIRST;
+  else
+    return false;
+
+  return true;
+}
+
+/**
+ * \brief Replay the queries of a log to profile the trie.
+ *
+ * The log holds approximator queries, one per line. The other lines are ignored.
+ *
+ * \param pt The trie.
+ * \param filename The path to the query log.
+ * \return true on success, false otherwise.
+ */
+static bool profile(PTrie& pt, const char* filename)
+{
+  std::ifstream in(filename);
+  if (!in)
   {
-    std::cerr << "usage: " << argv[0] << " /path/to/words.txt /path/to/dict.bin" << std::endl;
-    return 1;
+    std::cerr << "cannot open " << filename << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line))
+  {
+    std::istringstream query(line);
+    std::string cmd;
+    std::string token;
+    unsigned int count;
+    unsigned int dist;
+
+    query >> cmd;
+    if (cmd != "approx" && cmd != "approx-nearest")
+      continue;
+
+    // Skip the limits (<name>=<value>).
+    while (query >> token && token.find('=') != std::string::npos)
+      ;
+
+    // The first token after the limits is the number of words or the distance.
+    std::istringstream number(token);
+    if (cmd == "approx-nearest")
+    {
+      if (!(number >> count) || !(query >> dist))
+        continue;
+    }
+    else if (!(number >> dist))
+      continue;
+
+    // The word is the rest of the line.
+    if (query.get() != ' ')
+      continue;
+
+    std::string word;
+    std::getline(query, word);
+    if (!word.empty())
+      pt.profile(word, dist);
   }
 
+  return true;
+}
+
+/**
+ * \brief Compile a text dictionary.
+ *
+ * \param filename The path to the words.
+ * \param queries The path to the query log to profile the trie with, or NULL.
+ * \param output The path to the serialized trie.
+ * \param flags The format flags.
+ * \param words A pointer to a vector that will hold the words and their frequencies, or NULL.
+ * \param build_id A reference that will hold the build id of the trie.
+ * \return true on success, false otherwise.
+ */
+static bool compile(const char* filename,
+                    const char* queries,
+                    const std::string& output,
+                    unsigned int flags,
+                    std::vector<std::pair<std::string, unsigned long>>* words,
+                    unsigned long long& build_id)
+{
   PTrie pt;
 
-  std::ifstream in(argv[1]);
+  std::ifstream in(filename);
   std::string line;
   while (std::getline(in, line))
   {
@@ -23,7 +128,97 @@ int main(int argc, char* argv[])
     pt.add_word(word, freq);
   }
 
-  pt.serialize(argv[2]);
+  if (queries != nullptr && !profile(pt, queries))
+    return false;
+
+  build_id = pt.serialize(output, flags);
+
+  if (words != nullptr)
+    pt.get_words(*words);
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned int flags = 0;
+  const char* queries = nullptr;
+  unsigned int q = 0;
+  bool merge = false;
+  TrieMerger::Policy policy = TrieMerger::SUM;
+  int i;
+
+  for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i)
+  {
+    if (strcmp(argv[i], "--inline-labels") == 0)
+      flags |= TRIE_INLINE_LABELS;
+    else if (strcmp(argv[i], "--wide-offsets") == 0)
+      flags |= TRIE_WIDE_OFFSETS;
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      queries = argv[++i];
+    else if (strcmp(argv[i], "--qgram") == 0 && i + 1 < argc)
+      q = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--merge") == 0)
+      merge = true;
+    else if (strcmp(argv[i], "--duplicates") == 0 && i + 1 < argc)
+    {
+      if (!parse_policy(argv[++i], policy))
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (q > QGRAM_MAX_Q
+      || (merge && (argc - i < 2 || queries != nullptr))
+      || (!merge && argc - i != 2))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string output = argv[argc - 1];
+  std::vector<std::pair<std::string, unsigned long>> words;
+  unsigned long long build_id;
+
+  if (merge)
+  {
+    TrieMerger merger(policy);
+
+    for (; i < argc - 1; ++i)
+      if (!merger.add(argv[i]))
+        return 1;
+
+    merger.merge();
+    build_id = merger.serialize(output, flags);
+
+    if (q > 0)
+      merger.get_words(words);
+  }
+  else if (!compile(argv[i], queries, output, flags, q > 0 ? &words : nullptr, build_id))
+    return 1;
+
+  // The q-gram index goes next to the trie, a stale one is removed.
+  std::string index_filename = output + ".qgram";
+
+  if (q == 0)
+    std::remove(index_filename.c_str());
+  else
+  {
+    QGramIndex index(q);
+
+    for (const auto& w: words)
+      index.add_word(w.first, w.second);
+
+    index.serialize(index_filename, build_id);
+  }
 
   return 0;
 }
+
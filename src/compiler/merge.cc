@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include "approx/ptrie.hh"
+#include "merge.hh"
+#include "trie-writer.hh"
+
+namespace
+{
+  /*
+   * An edge of an input trie, whatever its format.
+   */
+  struct s_input_edge
+  {
+    const char* label;
+    unsigned long long length;
+    unsigned long long frequency;
+    unsigned long long children_count;
+    const void* children;
+  };
+
+  /*
+   * A position in an input trie: a char of an edge, or the end of the edge
+   * (i.e. its target node) when position == edge.length.
+   */
+  struct s_cursor
+  {
+    const s_trie* trie;
+    s_input_edge edge;
+    unsigned long long position;
+  };
+
+  template <typename Edge>
+  s_input_edge read_edge(const s_trie* trie, const Edge* edge)
+  {
+    return {get_label(trie, edge), edge->length, edge->frequency,
+            edge->children_count, get_child(edge)};
+  }
+
+  s_input_edge read_root(const s_trie* trie)
+  {
+    if (trie->flags & TRIE_WIDE_OFFSETS)
+      return read_edge(trie, get_root<s_wide_edge>(trie));
+    else
+      return read_edge(trie, get_root<s_edge>(trie));
+  }
+
+  s_input_edge read_child(const s_trie* trie, const s_input_edge& edge, unsigned long long i)
+  {
+    if (trie->flags & TRIE_WIDE_OFFSETS)
+      return read_edge(trie, (const s_wide_edge*) edge.children + i);
+    else
+      return read_edge(trie, (const s_edge*) edge.children + i);
+  }
+
+  unsigned char next_char(const s_cursor& c)
+  {
+    return c.edge.label[c.position];
+  }
+}
+
+TrieMerger::TrieMerger(Policy policy)
+  : _policy(policy)
+  , _max_frequency(0)
+{
+}
+
+TrieMerger::~TrieMerger()
+{
+  for (s_trie* trie: _inputs)
+    unload(trie);
+}
+
+bool TrieMerger::add(const std::string& filename)
+{
+  s_trie* trie = load(filename.c_str());
+
+  if (trie == NULL)
+    return false;
+
+  _inputs.push_back(trie);
+  return true;
+}
+
+void TrieMerger::merge()
+{
+  // The nodes left to build, with the index of the edge leading to them.
+  std::deque<std::pair<std::vector<s_cursor>, size_t>> nodes;
+  std::vector<s_cursor> roots;
+
+  for (const s_trie* trie: _inputs)
+    roots.push_back({trie, read_root(trie), 0});
+
+  _strs.clear();
+  _edges.assign(1, s_wide_edge{0, 0, 0, 0, 0});
+  _max_frequency = 0;
+  nodes.emplace_back(std::move(roots), 0);
+
+  while (!nodes.empty())
+  {
+    std::vector<s_cursor> node = std::move(nodes.front().first);
+    size_t parent = nodes.front().second;
+    nodes.pop_front();
+
+    // The ways out of the node in every input, in the order of the inputs.
+    std::vector<s_cursor> branches;
+
+    for (const s_cursor& c: node)
+    {
+      if (c.position < c.edge.length)
+        branches.push_back(c);
+      else
+        for (unsigned long long i = 0; i < c.edge.children_count; ++i)
+          branches.push_back({c.trie, read_child(c.trie, c.edge, i), 0});
+    }
+
+    // Group the branches by their first char, an input has at most one branch per group.
+    std::stable_sort(branches.begin(), branches.end(),
+                     [](const s_cursor& a, const s_cursor& b) { return next_char(a) < next_char(b); });
+
+    _edges[parent].children_count = 0;
+    _edges[parent].children_offset = branches.empty() ? 0 : _edges.size() - parent;
+
+    for (auto begin = branches.begin(); begin != branches.end(); )
+    {
+      auto end = begin + 1;
+      while (end != branches.end() && next_char(*end) == next_char(*begin))
+        ++end;
+
+      // The edge goes on while the group agrees and until one of its edges ends.
+      unsigned long long length = 1;
+      for (;; ++length)
+      {
+        auto it = begin;
+        for (; it != end; ++it)
+          if (it->position + length == it->edge.length
+              || it->edge.label[it->position + length] != begin->edge.label[begin->position + length])
+            break;
+
+        if (it != end)
+          break;
+      }
+
+      s_wide_edge edge = {_strs.size(), length, 0, 0, 0};
+      _strs.append(begin->edge.label + begin->position, length);
+
+      for (auto it = begin; it != end; ++it)
+      {
+        it->position += length;
+
+        unsigned long long frequency = it->position == it->edge.length ? it->edge.frequency : 0;
+        if (frequency == 0)
+          continue;
+
+        // The sum saturates rather than wraps.
+        if (_policy == SUM)
+          edge.frequency = std::min(edge.frequency, ULLONG_MAX - frequency) + frequency;
+        else if (_policy == MAX)
+          edge.frequency = std::max(edge.frequency, frequency);
+        else if (edge.frequency == 0)
+          edge.frequency = frequency;
+      }
+
+      _max_frequency = std::max(_max_frequency, edge.frequency);
+
+      ++_edges[parent].children_count;
+      nodes.emplace_back(std::vector<s_cursor>(begin, end), _edges.size());
+      _edges.push_back(edge);
+
+      begin = end;
+    }
+  }
+}
+
+void TrieMerger::get_words(std::vector<std::pair<std::string, unsigned long>>& words) const
+{
+  std::string prefix;
+  get_words(0, prefix, words);
+}
+
+void TrieMerger::get_words(size_t edge,
+                           std::string& prefix,
+                           std::vector<std::pair<std::string, unsigned long>>& words) const
+{
+  const s_wide_edge& e = _edges[edge];
+
+  if (e.frequency != 0)
+    words.emplace_back(prefix, e.frequency);
+
+  for (size_t i = 0; i < e.children_count; ++i)
+  {
+    const s_wide_edge& child = _edges[edge + e.children_offset + i];
+
+    prefix.append(_strs, child.offset, child.length);
+    get_words(edge + e.children_offset + i, prefix, words);
+    prefix.resize(prefix.size() - child.length);
+  }
+}
+
+unsigned long long TrieMerger::serialize(const std::string& filename, unsigned int flags) const
+{
+  if (_strs.size() >= UINT_MAX || _max_frequency > UINT_MAX)
+    flags |= TRIE_WIDE_OFFSETS;
+
+  if (flags & TRIE_WIDE_OFFSETS)
+    return serialize<s_wide_edge>(filename, flags);
+  return serialize<s_edge>(filename, flags);
+}
+
+template <typename EdgeType>
+unsigned long long TrieMerger::serialize(const std::string& filename, unsigned int flags) const
+{
+  typedef typename EdgeType::value_type T;
+
+  std::vector<EdgeType> edges;
+  std::string pool;
+
+  edges.reserve(_edges.size());
+
+  for (const s_wide_edge& e: _edges)
+  {
+    EdgeType edge = {(T) e.offset, (T) e.length, (T) e.frequency,
+                     (T) e.children_count, (T) e.children_offset};
+
+    // Only the char sequences that do not fit in the edge go to the buffer.
+    if (flags & TRIE_INLINE_LABELS)
+    {
+      if (edge.length <= sizeof (edge.offset))
+      {
+        edge.offset = 0;
+        _strs.copy((char*) &edge.offset, edge.length, e.offset);
+      }
+      else
+      {
+        edge.offset = pool.size();
+        pool.append(_strs, e.offset, e.length);
+      }
+    }
+
+    edges.push_back(edge);
+  }
+
+  return write_trie(filename, flags, (flags & TRIE_INLINE_LABELS) ? pool : _strs, edges);
+}
@@ -0,0 +1,115 @@
+#ifndef MERGE_HH
+# define MERGE_HH
+
+# include <string>
+# include <utility>
+# include <vector>
+
+# include "common/format.hh"
+
+// The loaded tries, see approx/ptrie.hh.
+struct s_trie;
+
+/**
+ * \brief TrieMerger class.
+ *
+ * Merges compiled tries without going through their words: the tries are
+ * mapped like the approximator does and walked together in breadth-first
+ * order, each node of the merged trie being a set of positions in the input
+ * tries. The edges are split where the inputs diverge.
+ */
+class TrieMerger
+{
+public:
+  /**
+   * \brief The frequency of a word found in several tries.
+   */
+  enum Policy
+  {
+    SUM,
+    MAX,
+    FIRST
+  };
+
+  /**
+   * \brief Construct an empty merger.
+   *
+   * \param policy The frequency policy for the duplicated words.
+   */
+  TrieMerger(Policy policy);
+
+  /**
+   * \brief Unload the input tries.
+   */
+  ~TrieMerger();
+
+  /**
+   * \brief Load an input trie.
+   *
+   * With the FIRST policy, the frequency of the first added trie wins.
+   *
+   * \param filename The path to the serialized trie.
+   * \return true on success, false otherwise.
+   */
+  bool add(const std::string& filename);
+
+  /**
+   * \brief Merge the input tries.
+   */
+  void merge();
+
+  /**
+   * \brief Get all the words of the merged trie.
+   *
+   * \param words A reference to a vector that will hold the words and their frequencies.
+   */
+  void get_words(std::vector<std::pair<std::string, unsigned long>>& words) const;
+
+  /**
+   * \brief Serialize the merged trie.
+   *
+   * The edges are widened (TRIE_WIDE_OFFSETS) when the trie does not fit in the
+   * narrow format.
+   *
+   * \param filename The path to the serialized trie.
+   * \param flags The format flags (TRIE_INLINE_LABELS, TRIE_WIDE_OFFSETS).
+   * \return The build id of the trie.
+   */
+  unsigned long long serialize(const std::string& filename, unsigned int flags) const;
+
+private:
+  Policy _policy;
+  std::vector<s_trie*> _inputs;
+
+  /*
+   * The merged trie: the char sequences buffer and the edges in
+   * breadth-first order, the virtual root edge first. The char sequences
+   * are never inlined here.
+   */
+  std::string _strs;
+  std::vector<s_wide_edge> _edges;
+  unsigned long long _max_frequency;
+
+  /**
+   * \brief Get the words below an edge of the merged trie.
+   *
+   * \param edge The index of the edge.
+   * \param prefix The char sequence from the root to the end of the edge.
+   * \param words A reference to a vector that will hold the words and their frequencies.
+   */
+  void get_words(size_t edge,
+                 std::string& prefix,
+                 std::vector<std::pair<std::string, unsigned long>>& words) const;
+
+  /**
+   * \brief Serialize the merged trie with a given edge format.
+   *
+   * \param filename The path to the serialized trie.
+   * \param flags The format flags.
+   * \return The build id of the trie.
+   */
+  template <typename EdgeType>
+  unsigned long long serialize(const std::string& filename, unsigned int flags) const;
+};
+
+# endif /* !MERGE_HH */
@@ -1,91 +1,204 @@
+#include <algorithm>
+#include <climits>
 #include <utility>
 #include <iterator>
-#include <fstream>
-#include <queue>
+#include <unordered_map>
+#include <vector>
 #include "ptrie.hh"
+#include "trie-writer.hh"
 
 std::string PTrie::strs;
 
-void PTrie::add_word(const std::string& word, unsigned int frequency)
+PTrie::PTrie()
+  : _max_frequency(0)
+  , _profiled(false)
+{
+}
+
+void PTrie::add_word(const std::string& word, unsigned long frequency)
 {
   _root.insert(word, frequency);
+  _max_frequency = std::max(_max_frequency, frequency);
 }
 
-void PTrie::serialize(std::ostream& out,
-                      unsigned int offset,
-                      unsigned int length,
-                      unsigned int frequency,
-                      unsigned int children_count,
-                      unsigned int children_offset) const
+unsigned long long PTrie::serialize(const std::string& filename, unsigned int flags) const
 {
-  out.write((char*) &offset, sizeof (unsigned int));
-  out.write((char*) &length, sizeof (unsigned int));
-  out.write((char*) &frequency, sizeof (unsigned int));
-  out.write((char*) &children_count, sizeof (unsigned int));
-  out.write((char*) &children_offset, sizeof (unsigned int));
+  // Every edge has its own char sequence in the buffer, so the number of edges
+  // (and the children offsets) are bounded by the size of the buffer.
+  if (strs.size() >= UINT_MAX || _max_frequency > UINT_MAX)
+    flags |= TRIE_WIDE_OFFSETS;
+
+  if (flags & TRIE_WIDE_OFFSETS)
+    return serialize<s_wide_edge>(filename, flags);
+  return serialize<s_edge>(filename, flags);
 }
 
-void PTrie::serialize(const std::string& filename) const
+void PTrie::get_words(std::vector<std::pair<std::string, unsigned long>>& words) const
 {
-  std::ofstream out(filename, std::ios::out | std::ios::binary);
+  std::string prefix;
+  _root.get_words(prefix, words);
+}
 
-  unsigned int tmp = strs.size();
-  out.write((char*) &tmp, sizeof (unsigned int));
-  out.write(strs.c_str(), strs.size());
+void PTrie::profile(const std::string& word, unsigned int max_dist)
+{
+  std::vector<DLRow> rows(1);
 
-  std::queue<const Node*> queue;
-  queue.push(&_root);
-  queue.push(nullptr);
+  rows[0].init(word.length() + 1, max_dist);
+  _root.profile(word, max_dist, rows, 0);
+  _profiled = true;
+}
 
-  size_t i = 0;
-  size_t children = _root.get_edges().size();
-  size_t children_next = 0;
+template <typename EdgeType>
+unsigned long long PTrie::serialize(const std::string& filename, unsigned int flags) const
+{
+  typedef typename EdgeType::value_type T;
 
-  // Virtual edge to represent the trie's root
-  serialize(out, 0, 0, 0, children, children ? 1 : 0);
+  // The nodes with children in breadth-first order, with their edges. The edges
+  // of a node are stored contiguously, the most visited first.
+  std::vector<std::pair<const Node*, std::vector<const Edge*>>> nodes;
 
-  do {
-    const Node* n = queue.front();
-    queue.pop();
+  if (!_root.get_edges().empty())
+    nodes.emplace_back(&_root, std::vector<const Edge*>());
 
-    if (n == nullptr)
-    {
-      i = 0;
-      children = children_next;
-      children_next = 0;
-      if (!queue.empty())
-        queue.push(nullptr);
-    }
-    else if (!n->get_edges().empty())
+  for (size_t n = 0; n < nodes.size(); ++n)
+  {
+    std::vector<const Edge*> edges;
+
+    for (const Edge& e: nodes[n].first->get_edges())
+      edges.push_back(&e);
+
+    std::stable_sort(edges.begin(), edges.end(),
+                     [](const Edge* a, const Edge* b) { return a->get_visits() > b->get_visits(); });
+
+    for (const Edge* e: edges)
+      if (!e->get_target_node().get_edges().empty())
+        nodes.emplace_back(&e->get_target_node(), std::vector<const Edge*>());
+
+    nodes[n].second = std::move(edges);
+  }
+
+  // The nodes reached by the profiled queries go first, in a compact hot region.
+  std::stable_partition(nodes.begin(), nodes.end(),
+                        [](const std::pair<const Node*, std::vector<const Edge*>>& n)
+                        {
+                          return n.first->get_visits() > 0;
+                        });
+
+  // Position of the leftmost edge of each node, after the virtual root edge.
+  std::unordered_map<const Node*, size_t> positions;
+  size_t position = 1;
+
+  for (const auto& n: nodes)
+  {
+    positions[n.first] = position;
+    position += n.second.size();
+  }
+
+  std::vector<EdgeType> edges;
+  std::string pool;
+
+  // The char sequences buffer is rebuilt in the order of the edges when they are reordered.
+  bool rebuild = (flags & TRIE_INLINE_LABELS) || _profiled;
+
+  // Virtual edge to represent the trie's root
+  size_t children = _root.get_edges().size();
+  edges.push_back({0, 0, 0, (T) children, (T) (children ? positions[&_root] : 0)});
+
+  for (const auto& n: nodes)
+  {
+    for (const Edge* e: n.second)
     {
-      for (const Edge& e: n->get_edges())
+      EdgeType edge;
+      const Node& target = e->get_target_node();
+
+      edge.offset = e->get_offset();
+      edge.length = e->get_length();
+      edge.frequency = target.get_frequency();
+      edge.children_count = target.get_edges().size();
+      edge.children_offset = target.get_edges().empty() ? 0 : positions[&target] - edges.size();
+
+      // Only the char sequences that do not fit in the edge go to the buffer.
+      if ((flags & TRIE_INLINE_LABELS) && edge.length <= sizeof (edge.offset))
+      {
+        edge.offset = 0;
+        strs.copy((char*) &edge.offset, edge.length, e->get_offset());
+      }
+      else if (rebuild)
       {
-        serialize(out,
-                  e.get_offset(),
-                  e.get_length(),
-                  e.get_target_node().get_frequency(),
-                  e.get_target_node().get_edges().size(),
-                  e.get_target_node().get_edges().empty() ? 0 : ((children - i) + children_next));
-
-        i++;
-        children_next += e.get_target_node().get_edges().size();
-        queue.push(&e.get_target_node());
+        edge.offset = pool.size();
+        pool.append(strs, e->get_offset(), edge.length);
       }
+
+      edges.push_back(edge);
     }
-  } while (!queue.empty());
+  }
+
+  return write_trie(filename, flags, rebuild ? pool : strs, edges);
 }
 
-PTrie::Node::Node(unsigned int frequency)
+PTrie::Node::Node(unsigned long frequency)
   : _frequency(frequency)
+  , _visits(0)
 {
 }
 
 PTrie::Node::Node()
   : _frequency(0)
+  , _visits(0)
+{
+}
+
+void PTrie::Node::get_words(std::string& prefix,
+                            std::vector<std::pair<std::string, unsigned long>>& words) const
+{
+  if (_frequency != 0)
+    words.emplace_back(prefix, _frequency);
+
+  for (const Edge& e: _edges)
+  {
+    prefix.append(strs, e.get_offset(), e.get_length());
+    e.get_target_node().get_words(prefix, words);
+    prefix.resize(prefix.size() - e.get_length());
+  }
+}
+
+void PTrie::Node::profile(const std::string& word,
+                          unsigned int max_dist,
+                          std::vector<DLRow>& rows,
+                          size_t depth)
 {
+  ++_visits;
+
+  for (Edge& e: _edges)
+  {
+    size_t end = depth + e.get_length();
+    size_t i;
+
+    if (rows.size() <= end)
+      rows.resize(end + 1);
+
+    // Build one row par chararacter in the sequence, like the search does.
+    for (i = 0; i < e.get_length(); ++i)
+    {
+      rows[depth + i + 1].compute(rows[depth + i],
+                                  depth + i > 0 ? &rows[depth + i - 1] : nullptr,
+                                  word,
+                                  strs[e.get_offset() + i],
+                                  max_dist);
+
+      if (rows[depth + i + 1].is_final())
+        break;
+
+      if (i == 0)
+        e.visit();
+    }
+
+    if (i == e.get_length())
+      e.get_target_node().profile(word, max_dist, rows, end);
+  }
 }
 
-void PTrie::Node::insert(const std::string& word, unsigned int frequency)
+void PTrie::Node::insert(const std::string& word, unsigned long frequency)
 {
   // Easy case, word is a prefix of another word in the trie.
   if (word.empty())
@@ -125,14 +238,19 @@ void PTrie::Node::insert(const std::string& word, unsigned int frequency)
     return;
 
   // No prefix found, create a new edge.
-  unsigned int offset = strs.length();
+  unsigned long offset = strs.length();
   unsigned int length = word.length();
   strs += word;
 
   _edges.emplace_back(offset, length, frequency);
 }
 
-unsigned int PTrie::Node::get_frequency() const
+unsigned long PTrie::Node::get_visits() const
+{
+  return _visits;
+}
+
+unsigned long PTrie::Node::get_frequency() const
 {
   return _frequency;
 }
@@ -148,9 +266,10 @@ std::list<PTrie::Edge>& PTrie::Node::get_edges()
 }
 
 
-PTrie::Edge::Edge(unsigned int offset, unsigned int length, unsigned int frequency)
+PTrie::Edge::Edge(unsigned long offset, unsigned int length, unsigned long frequency)
   : _offset(offset)
   , _length(length)
+  , _visits(0)
   , _target_node(frequency)
 {
 }
@@ -173,7 +292,7 @@ PTrie::Node& PTrie::Edge::get_target_node()
   return _target_node;
 }
 
-unsigned int PTrie::Edge::get_offset() const
+unsigned long PTrie::Edge::get_offset() const
 {
   return _offset;
 }
@@ -182,3 +301,13 @@ unsigned int PTrie::Edge::get_length() const
 {
   return _length;
 }
+
+void PTrie::Edge::visit()
+{
+  ++_visits;
+}
+
+unsigned long PTrie::Edge::get_visits() const
+{
+  return _visits;
+}
@@ -2,28 +2,62 @@
 # define PTRIE_HH
 
 # include <string>
+# include <utility>
 # include <list>
 # include <ostream>
+# include <vector>
+
+# include "common/format.hh"
+# include "approx/dl-row.hh"
 
 class PTrie
 {
 public:
   static std::string strs;
 
+  /**
+   * \brief Construct an empty trie.
+   */
+  PTrie();
+
   /**
    * \brief Add a new word in the trie.
    *
    * \param word The new word.
    * \param frequency The frequency of the word.
    */
-  void add_word(const std::string& word, unsigned int frequency);
+  void add_word(const std::string& word, unsigned long frequency);
+
+  /**
+   * \brief Get all the words of the trie.
+   *
+   * \param words A reference to a vector that will hold the words and their frequencies.
+   */
+  void get_words(std::vector<std::pair<std::string, unsigned long>>& words) const;
+
+  /**
+   * \brief Replay a query to profile the trie.
+   *
+   * It visits the trie like the approximative search does and counts
+   * the visits of the nodes and edges. The serialization then puts the visited
+   * edges first and orders the siblings by decreasing number of visits.
+   *
+   * \param word The word to approximate.
+   * \param max_dist The maximal distance.
+   */
+  void profile(const std::string& word, unsigned int max_dist);
 
   /**
    * \brief Serialize the trie.
    *
+   * The edges are widened (TRIE_WIDE_OFFSETS) when the trie does not fit in the
+   * narrow format.
+   *
    * \param filename The path to the serialized trie.
+   * \param flags The format flags (TRIE_INLINE_LABELS, TRIE_WIDE_OFFSETS).
+   * \return The build id of the trie.
    */
-  void serialize(const std::string& filename) const;
+  unsigned long long serialize(const std::string& filename, unsigned int flags) const;
 
 private:
   // Forward declaration.
@@ -43,7 +77,7 @@ private:
      *
      * \param frequency The frequency of the word that terminates here.
      */
-    Node(unsigned int frequency);
+    Node(unsigned long frequency);
 
     /**
      * \brief Construct a node.
@@ -58,7 +92,29 @@ private:
      * \param word The word.
      * \param frequency The frequency of the word.
      */
-    void insert(const std::string& word, unsigned int frequency);
+    void insert(const std::string& word, unsigned long frequency);
+
+    /**
+     * \brief Get the words that go through this node.
+     *
+     * \param prefix The char sequence from the root to this node.
+     * \param words A reference to a vector that will hold the words and their frequencies.
+     */
+    void get_words(std::string& prefix,
+                   std::vector<std::pair<std::string, unsigned long>>& words) const;
+
+    /**
+     * \brief Replay a query from this node.
+     *
+     * \param word The word to approximate.
+     * \param max_dist The maximal distance.
+     * \param rows The rows of the matrix along the path, rows[depth] is the last one.
+     * \param depth The length of the path to this node.
+     */
+    void profile(const std::string& word,
+                 unsigned int max_dist,
+                 std::vector<DLRow>& rows,
+                 size_t depth);
 
     /**
      * \brief Get the edges associated to this node (const version).
@@ -81,10 +137,16 @@ private:
      *
      * \return The frequency.
      */
-    unsigned int get_frequency() const;
+    unsigned long get_frequency() const;
+
+    /**
+     * \brief Get the number of profiled queries that reached the node.
+     */
+    unsigned long get_visits() const;
 
   private:
-    unsigned int _frequency;
+    unsigned long _frequency;
+    unsigned long _visits;
     std::list<Edge> _edges;
   };
 
@@ -103,7 +165,7 @@ private:
      * \param length The length of the char sequence in the string buffer.
      * \param frequency The frequency of the word that terminates with this char sequence.
      */
-    Edge(unsigned int offset, unsigned int length, unsigned int frequency);
+    Edge(unsigned long offset, unsigned int length, unsigned long frequency);
 
     /**
      * \brief Split the edge.
@@ -128,37 +190,43 @@ private:
     /**
      * \brief Get the offset of the char sequence.
      */
-    unsigned int get_offset() const;
+    unsigned long get_offset() const;
 
     /**
      * \brief Get the length of the char sequence.
      */
     unsigned int get_length() const;
 
+    /**
+     * \brief Count a profiled query that entered the edge.
+     */
+    void visit();
+
+    /**
+     * \brief Get the number of profiled queries that entered the edge.
+     */
+    unsigned long get_visits() const;
+
   private:
-    unsigned int _offset;
+    unsigned long _offset;
     unsigned int _length;
+    unsigned long _visits;
     Node _target_node;
   };
 
   Node _root;
+  unsigned long _max_frequency;
+  bool _profiled;
 
   /**
-   * \brief Helper function to serialize an edge.
+   * \brief Serialize the trie with a given edge format.
    *
-   * \param out The stream to write into.
-   * \param offset The offset of the char sequence.
-   * \param length The length of the char sequence.
-   * \param frequency The frequency of the word that terminates with this char sequence (if it exists).
-   * \param children_count The number of children in the trie.
-   * \param children_offset The offset to access its leftmost child.
+   * \param filename The path to the serialized trie.
+   * \param flags The format flags.
+   * \return The build id of the trie.
    */
-  void serialize(std::ostream& out,
-                 unsigned int offset,
-                 unsigned int length,
-                 unsigned int frequency,
-                 unsigned int children_count,
-                 unsigned int children_offset) const;
+  template <typename EdgeType>
+  unsigned long long serialize(const std::string& filename, unsigned int flags) const;
 };
 
 
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <fstream>
+#include "qgram.hh"
+
+QGramIndex::QGramIndex(unsigned int q)
+  : _q(q)
+{
+}
+
+void QGramIndex::add_word(const std::string& word, unsigned long frequency)
+{
+  unsigned long long id = _words.size();
+
+  _words.push_back({_chars.size(), frequency, word.length()});
+  _chars += word;
+
+  for (size_t i = 0; i + _q <= word.length(); ++i)
+  {
+    unsigned long long gram = 0;
+
+    for (size_t j = 0; j < _q; ++j)
+      gram = (gram << 8) | (unsigned char) word[i + j];
+
+    _grams.emplace_back(gram, id);
+  }
+}
+
+void QGramIndex::serialize(const std::string& filename, unsigned long long trie_build_id) const
+{
+  std::vector<std::pair<unsigned long long, unsigned long long>> grams(_grams);
+  std::vector<s_qgram_entry> entries;
+  std::string postings;
+
+  std::sort(grams.begin(), grams.end());
+
+  unsigned long long previous = 0;
+
+  for (size_t i = 0; i < grams.size(); ++i)
+  {
+    // New q-gram, the deltas restart from 0.
+    if (i == 0 || grams[i].first != grams[i - 1].first)
+    {
+      entries.push_back({grams[i].first, postings.size(), 0});
+      previous = 0;
+    }
+
+    unsigned long long delta = grams[i].second - previous;
+    previous = grams[i].second;
+    ++entries.back().count;
+
+    while (delta >= 0x80)
+    {
+      postings.push_back((char) (delta | 0x80));
+      delta >>= 7;
+    }
+    postings.push_back((char) delta);
+  }
+
+  std::ofstream out(filename, std::ios::out | std::ios::binary);
+
+  s_qgram_header header = {QGRAM_MAGIC, _q, _words.size(), entries.size(), _chars.size(), postings.size(),
+                           trie_build_id};
+  out.write((char*) &header, sizeof (s_qgram_header));
+  out.write((char*) _words.data(), _words.size() * sizeof (s_qgram_word));
+  out.write((char*) entries.data(), entries.size() * sizeof (s_qgram_entry));
+  out.write(_chars.c_str(), _chars.size());
+  out.write(postings.c_str(), postings.size());
+}
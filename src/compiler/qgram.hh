@@ -0,0 +1,56 @@
+#ifndef QGRAM_HH
+# define QGRAM_HH
+
+# include <string>
+# include <utility>
+# include <vector>
+
+# include "common/format.hh"
+
+/**
+ * \brief QGramIndex class.
+ *
+ * An inverted index from the q-grams to the words containing them, used by the
+ * approximator to filter the candidates of the long queries at high distance.
+ */
+class QGramIndex
+{
+public:
+  /**
+   * \brief Construct an empty index.
+   *
+   * \param q The length of the q-grams, between 1 and QGRAM_MAX_Q.
+   */
+  QGramIndex(unsigned int q);
+
+  /**
+   * \brief Add a new word in the index.
+   *
+   * \param word The new word.
+   * \param frequency The frequency of the word.
+   */
+  void add_word(const std::string& word, unsigned long frequency);
+
+  /**
+   * \brief Serialize the index.
+   *
+   * The build id of the trie is recorded in the index, so the approximator
+   * only uses the index with this trie.
+   *
+   * \param filename The path to the serialized index.
+   * \param trie_build_id The build id of the trie of the same words.
+   */
+  void serialize(const std::string& filename, unsigned long long trie_build_id) const;
+
+private:
+  unsigned int _q;
+  std::vector<s_qgram_word> _words;
+  std::string _chars;
+
+  /*
+   * (q-gram, word id) pairs, one per occurrence.
+   */
+  std::vector<std::pair<unsigned long long, unsigned long long>> _grams;
+};
+
+# endif /* !QGRAM_HH */
@@ -0,0 +1,53 @@
+#ifndef TRIE_WRITER_HH
+# define TRIE_WRITER_HH
+
+# include <chrono>
+# include <fstream>
+# include <random>
+# include <string>
+# include <vector>
+
+# include "common/format.hh"
+
+/**
+ * \brief Write a serialized trie.
+ *
+ * The edges are aligned after the char sequences buffer, see common/format.hh.
+ * The trie gets a new build id (TRIE_BUILD_ID).
+ *
+ * \param filename The path to the serialized trie.
+ * \param flags The format flags.
+ * \param buffer The char sequences buffer.
+ * \param edges The edges, the virtual root edge first.
+ * \return The build id of the trie, never 0.
+ */
+template <typename EdgeType>
+unsigned long long write_trie(const std::string& filename,
+                unsigned int flags,
+                const std::string& buffer,
+                const std::vector<EdgeType>& edges)
+{
+  std::ofstream out(filename, std::ios::out | std::ios::binary);
+
+  // The random device alone may be deterministic, mix the time in.
+  std::random_device random;
+  unsigned long long build_id = ((unsigned long long) random() << 32 | random())
+    ^ std::chrono::system_clock::now().time_since_epoch().count();
+  if (build_id == 0)
+    build_id = 1;
+
+  s_header header = {TRIE_MAGIC, flags | TRIE_BUILD_ID, buffer.size()};
+  out.write((char*) &header, sizeof (s_header));
+  out.write((char*) &build_id, sizeof (build_id));
+  out.write(buffer.c_str(), buffer.size());
+
+  // Align the edges.
+  size_t start = sizeof (s_header) + sizeof (build_id) + buffer.size();
+  size_t padding = (alignof (EdgeType) - start % alignof (EdgeType)) % alignof (EdgeType);
+  out.write("\0\0\0\0\0\0\0\0", padding);
+
+  out.write((char*) edges.data(), edges.size() * sizeof (EdgeType));
+  return build_id;
+}
+
+# endif /* !TRIE_WRITER_HH */